@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#define SESSION_OPEN 00000004
+
+/*
+ * Measure the throughput of 1 MB reads and writes on a file opened in session.
+ *
+ * Run it once with the default module parameters and once after disabling the
+ * copy of whole runs of pages, in order to compare the two:
+ *
+ * echo 0 > /sys/module/session_module/parameters/session_run_copy
+ */
+
+#define CHUNK_SIZE (1<<20)
+#define PARAMETER "/sys/module/session_module/parameters/session_run_copy"
+
+double elapsed(struct timespec* start){
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC,&now);
+        return (now.tv_sec-start->tv_sec)+(now.tv_nsec-start->tv_nsec)/1e9;
+}
+
+int main(int argc, char** argv){
+        int fd,ret,i,j,megabytes,iterations;
+        const char* filename;
+        char* chunk;
+        char mode[8];
+        FILE* parameter;
+        struct timespec start;
+        double seconds;
+        if(argc>1){
+                filename = argv[1];
+                megabytes = argc>2 ? strtol(argv[2],NULL,10) : 64;
+                iterations = argc>3 ? strtol(argv[3],NULL,10) : 10;
+                chunk=malloc(CHUNK_SIZE);
+                if(!chunk||megabytes<=0||iterations<=0){
+                        printf("Invalid arguments or not enough memory\n");
+                        return EINVAL;
+                }
+                memset(chunk,'x',CHUNK_SIZE);
+                strcpy(mode,"?");
+                parameter=fopen(PARAMETER,"r");
+                if(parameter){
+                        if(!fgets(mode,sizeof(mode),parameter))
+                                strcpy(mode,"?");
+                        mode[strcspn(mode,"\n")]=0;
+                        fclose(parameter);
+                }
+                printf("Copy of whole runs of pages (session_run_copy):%s\n",mode);
+
+                /*
+                 * Create the file without the session semantics
+                 */
+
+                fd=open(filename,O_WRONLY|O_CREAT|O_TRUNC,0644);
+                if(fd<0){
+                        printf("Could not create file because of error:%d\n",errno);
+                        return errno;
+                }
+                for(i=0;i<megabytes;i++)
+                        if(write(fd,chunk,CHUNK_SIZE)!=CHUNK_SIZE){
+                                printf("Could not create file because of error:%d\n",errno);
+                                return errno;
+                        }
+                close(fd);
+
+                fd=open(filename,O_RDWR|SESSION_OPEN);
+                if(fd<0) {
+                        printf("Error while opening session:%d\n",errno);
+                        return errno;
+                }
+
+                /*
+                 * Read the whole session in 1 MB chunks
+                 */
+
+                clock_gettime(CLOCK_MONOTONIC,&start);
+                for(i=0;i<iterations;i++){
+                        lseek(fd,0,SEEK_SET);
+                        for(j=0;j<megabytes;j++){
+                                ret=read(fd,chunk,CHUNK_SIZE);
+                                if(ret!=CHUNK_SIZE){
+                                        printf("Could not read session because of error:%d\n",errno);
+                                        return errno;
+                                }
+                        }
+                }
+                seconds=elapsed(&start);
+                printf("Read: %d MB in %.3f s, %.1f MB/s\n",megabytes*iterations,seconds,megabytes*iterations/seconds);
+
+                /*
+                 * Overwrite the whole session in 1 MB chunks
+                 */
+
+                clock_gettime(CLOCK_MONOTONIC,&start);
+                for(i=0;i<iterations;i++){
+                        lseek(fd,0,SEEK_SET);
+                        for(j=0;j<megabytes;j++){
+                                ret=write(fd,chunk,CHUNK_SIZE);
+                                if(ret!=CHUNK_SIZE){
+                                        printf("Could not write into session because of error:%d\n",errno);
+                                        return errno;
+                                }
+                        }
+                }
+                seconds=elapsed(&start);
+                printf("Write: %d MB in %.3f s, %.1f MB/s\n",megabytes*iterations,seconds,megabytes*iterations/seconds);
+
+                /*
+                 * Close the session, flushing it into the file
+                 */
+
+                clock_gettime(CLOCK_MONOTONIC,&start);
+                close(fd);
+                printf("Close: %.3f s\n",elapsed(&start));
+                free(chunk);
+                return 0;
+        }
+        printf("Invalid arguments: provide absolute filepath as first parameter; optionally provide size of the file\n"
+               "in MB (default 64) as second parameter and number of iterations (default 10) as third one\n");
+        return EINVAL;
+}
@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define SESSION_OPEN 00000004
+
+/*
+ * Measure the latency of many small sessions committed at the same time: each of
+ * the child processes opens its own file in session, writes a few KB into it, then
+ * all of them close their session together.
+ *
+ * Run it once with the default module parameters and once after enabling group
+ * commit, in order to compare the two:
+ *
+ * echo 5 > /sys/module/session_module/parameters/session_group_commit_ms
+ *
+ * Closing a session in a group makes its content durable, so when group commit is
+ * disabled each child calls fsync before close, to compare the same guarantees
+ */
+
+#define CHUNK_SIZE (4<<10)
+#define PARAMETER "/sys/module/session_module/parameters/session_group_commit_ms"
+
+double elapsed(struct timespec* start){
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC,&now);
+        return (now.tv_sec-start->tv_sec)+(now.tv_nsec-start->tv_nsec)/1e9;
+}
+
+int main(int argc, char** argv){
+        int fd,i,j,sessions,kilobytes,group,status,barrier[2],results[2];
+        const char* directory;
+        char filename[4096];
+        char chunk[CHUNK_SIZE];
+        char mode[8];
+        FILE* parameter;
+        struct timespec start;
+        double seconds,latency,total,slowest;
+        pid_t pid;
+        if(argc>1){
+                directory = argv[1];
+                sessions = argc>2 ? strtol(argv[2],NULL,10) : 500;
+                kilobytes = argc>3 ? strtol(argv[3],NULL,10) : 8;
+                if(sessions<=0||kilobytes<=0){
+                        printf("Invalid arguments\n");
+                        return EINVAL;
+                }
+                memset(chunk,'x',CHUNK_SIZE);
+                strcpy(mode,"?");
+                parameter=fopen(PARAMETER,"r");
+                if(parameter){
+                        if(!fgets(mode,sizeof(mode),parameter))
+                                strcpy(mode,"?");
+                        mode[strcspn(mode,"\n")]=0;
+                        fclose(parameter);
+                }
+                group=strtol(mode,NULL,10)>0;
+                printf("Group commit window in ms (session_group_commit_ms):%s\n",mode);
+                if(pipe(barrier)||pipe(results)){
+                        printf("Could not create pipes because of error:%d\n",errno);
+                        return errno;
+                }
+
+                /*
+                 * Every child opens its session and writes into it, then waits on
+                 * the barrier and reports how long its close took
+                 */
+
+                for(i=0;i<sessions;i++){
+                        pid=fork();
+                        if(pid<0){
+                                printf("Could not fork because of error:%d\n",errno);
+                                return errno;
+                        }
+                        if(pid)
+                                continue;
+                        close(barrier[1]);
+                        close(results[0]);
+                        snprintf(filename,sizeof(filename),"%s/session-%d",directory,i);
+                        fd=open(filename,O_RDWR|O_CREAT|O_TRUNC|SESSION_OPEN,0644);
+                        if(fd<0) {
+                                printf("Error while opening session:%d\n",errno);
+                                exit(errno);
+                        }
+                        for(j=0;j<kilobytes;j+=CHUNK_SIZE>>10)
+                                if(write(fd,chunk,CHUNK_SIZE)!=CHUNK_SIZE){
+                                        printf("Could not write into session because of error:%d\n",errno);
+                                        exit(errno);
+                                }
+                        if(read(barrier[0],&status,1)<0)
+                                exit(errno);
+                        clock_gettime(CLOCK_MONOTONIC,&start);
+                        if(!group&&fsync(fd)){
+                                printf("Could not synchronize session because of error:%d\n",errno);
+                                exit(errno);
+                        }
+                        if(close(fd)){
+                                printf("Could not close session because of error:%d\n",errno);
+                                exit(errno);
+                        }
+                        latency=elapsed(&start);
+                        if(write(results[1],&latency,sizeof(latency))!=sizeof(latency))
+                                exit(errno);
+                        exit(0);
+                }
+                close(barrier[0]);
+                close(results[1]);
+
+                /*
+                 * Let the children open their sessions, then release all of them at
+                 * once by closing the barrier
+                 */
+
+                sleep(1);
+                clock_gettime(CLOCK_MONOTONIC,&start);
+                close(barrier[1]);
+                total=0;
+                slowest=0;
+                for(i=0;i<sessions&&read(results[0],&latency,sizeof(latency))==sizeof(latency);i++){
+                        total+=latency;
+                        if(latency>slowest)
+                                slowest=latency;
+                }
+                seconds=elapsed(&start);
+                while(wait(&status)>0);
+                if(i<sessions){
+                        printf("Only %d sessions out of %d were committed\n",i,sessions);
+                        return EIO;
+                }
+                printf("Committed %d sessions of %d KB in %.3f s, %.0f sessions/s\n",sessions,kilobytes,seconds,sessions/seconds);
+                printf("Close latency: average %.3f ms, max %.3f ms\n",total/sessions*1000,slowest*1000);
+                return 0;
+        }
+        printf("Invalid arguments: provide absolute path of a directory as first parameter; optionally provide number of\n"
+               "sessions (default 500) as second parameter and size of each session in KB (default 8) as third one\n");
+        return EINVAL;
+}
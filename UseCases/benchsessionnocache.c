@@ -0,0 +1,150 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define SESSION_OPEN 00000004
+
+/*
+ * Measure the throughput of large writes into a session and their impact on the CPU
+ * cache of a co-running thread, that keeps walking a working set while the writes
+ * are performed and counts its own cache misses.
+ *
+ * Run it once with the default module parameters and once after disabling the
+ * cache-bypassing copies, in order to compare the two:
+ *
+ * echo 0 > /sys/module/session_module/parameters/session_nocache_threshold
+ */
+
+#define CHUNK_SIZE (4<<20)
+#define WORKING_SET (4<<20)
+#define LINE 64
+#define PARAMETER "/sys/module/session_module/parameters/session_nocache_threshold"
+
+volatile int stop;
+unsigned long long walks;
+long long misses;
+
+double elapsed(struct timespec* start){
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC,&now);
+        return (now.tv_sec-start->tv_sec)+(now.tv_nsec-start->tv_nsec)/1e9;
+}
+
+/*
+ * Co-running workload: walk the working set one cache line at a time until the
+ * writer is done, counting the cache misses of this thread if the kernel allows it
+ */
+
+void* corunner(void* arg){
+        struct perf_event_attr attr;
+        char* set;
+        int fd,i;
+        unsigned long sum=0;
+        set=malloc(WORKING_SET);
+        if(!set)
+                return NULL;
+        memset(set,1,WORKING_SET);
+        memset(&attr,0,sizeof(attr));
+        attr.type=PERF_TYPE_HARDWARE;
+        attr.size=sizeof(attr);
+        attr.config=PERF_COUNT_HW_CACHE_MISSES;
+        attr.exclude_kernel=1;
+        fd=syscall(__NR_perf_event_open,&attr,0,-1,-1,0);
+        if(fd>=0)
+                ioctl(fd,PERF_EVENT_IOC_RESET,0);
+        while(!stop){
+                for(i=0;i<WORKING_SET;i+=LINE)
+                        sum+=set[i];
+                walks++;
+        }
+        misses=-1;
+        if(fd>=0){
+                if(read(fd,&misses,sizeof(misses))!=sizeof(misses))
+                        misses=-1;
+                close(fd);
+        }
+        free(set);
+        return (void*)sum;
+}
+
+int main(int argc, char** argv){
+        int fd,ret,i,megabytes;
+        const char* filename;
+        char* chunk;
+        char threshold[32];
+        FILE* parameter;
+        pthread_t thread;
+        struct timespec start;
+        double seconds;
+        if(argc>1){
+                filename = argv[1];
+                megabytes = argc>2 ? strtol(argv[2],NULL,10) : 256;
+                megabytes -= megabytes%(CHUNK_SIZE>>20);
+                chunk=malloc(CHUNK_SIZE);
+                if(!chunk||megabytes<=0){
+                        printf("Invalid arguments or not enough memory\n");
+                        return EINVAL;
+                }
+                memset(chunk,'x',CHUNK_SIZE);
+                strcpy(threshold,"?");
+                parameter=fopen(PARAMETER,"r");
+                if(parameter){
+                        if(!fgets(threshold,sizeof(threshold),parameter))
+                                strcpy(threshold,"?");
+                        threshold[strcspn(threshold,"\n")]=0;
+                        fclose(parameter);
+                }
+                printf("Threshold for cache-bypassing copies (session_nocache_threshold):%s\n",threshold);
+
+                fd=open(filename,O_RDWR|O_CREAT|O_TRUNC|SESSION_OPEN,0644);
+                if(fd<0) {
+                        printf("Error while opening session:%d\n",errno);
+                        return errno;
+                }
+                if(pthread_create(&thread,NULL,corunner,NULL)){
+                        printf("Could not start the co-running thread\n");
+                        return EAGAIN;
+                }
+
+                /*
+                 * Write the session in large chunks, then close it to commit the
+                 * content to the file
+                 */
+
+                clock_gettime(CLOCK_MONOTONIC,&start);
+                for(i=0;i<megabytes/(CHUNK_SIZE>>20);i++){
+                        ret=write(fd,chunk,CHUNK_SIZE);
+                        if(ret!=CHUNK_SIZE){
+                                printf("Could not write into session because of error:%d\n",errno);
+                                return errno;
+                        }
+                }
+                seconds=elapsed(&start);
+                printf("Write: %d MB in %.3f s, %.1f MB/s\n",megabytes,seconds,megabytes/seconds);
+                clock_gettime(CLOCK_MONOTONIC,&start);
+                close(fd);
+                printf("Close: %.3f s\n",elapsed(&start));
+
+                stop=1;
+                pthread_join(thread,NULL);
+                printf("Co-running thread: %llu walks of its working set",walks);
+                if(misses>=0)
+                        printf(", %lld cache misses, %.1f misses per walk\n",misses,walks?(double)misses/walks:0.0);
+                else
+                        printf(", cache misses not available\n");
+                free(chunk);
+                return 0;
+        }
+        printf("Invalid arguments: provide absolute filepath as first parameter; optionally provide the number\n"
+               "of MB to be written (default 256) as second parameter\n");
+        return EINVAL;
+}
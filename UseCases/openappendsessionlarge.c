@@ -0,0 +1,110 @@
+#define _FILE_OFFSET_BITS 64
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define SESSION_OPEN 00000004
+
+/*
+ * The file is made sparse up to 1 MB before the 8 GB mark, then 2 MB are
+ * appended in session, so that the written bytes cross the 8 GB mark
+ */
+
+#define SPARSE_SIZE ((8LL<<30)-(1LL<<20))
+#define CHUNK_SIZE (1<<20)
+#define CHUNKS 2
+
+int main(int argc, char** argv){
+        int fd,ret,i;
+        off_t pos;
+        const char* filename;
+        char* chunk;
+        char* check;
+        if(argc>1){
+                filename = argv[1];
+                chunk=malloc(CHUNK_SIZE);
+                check=malloc(CHUNK_SIZE);
+                if(!chunk||!check){
+                        printf("Not enough memory for the test buffers\n");
+                        return ENOMEM;
+                }
+                printf("PID of current process:%d\n",getpid());
+
+                /*
+                 * Create the sparse file without the session semantics
+                 */
+
+                printf("Creating sparse file %s of %lld bytes\n",filename,(long long)SPARSE_SIZE);
+                fd=open(filename,O_WRONLY|O_CREAT|O_TRUNC,0644);
+                if(fd<0||ftruncate(fd,SPARSE_SIZE)){
+                        printf("Could not create sparse file because of error:%d\n",errno);
+                        return errno;
+                }
+                close(fd);
+
+                /*
+                 * Open an append-only session on the file: its content is not loaded
+                 */
+
+                printf("Opening file using append-only session semantics\n");
+                fd=open(filename,O_WRONLY|O_APPEND|SESSION_OPEN);
+                if(fd<0) {
+                        printf("Error while opening session:%d\n",errno);
+                        return errno;
+                }
+                pos=lseek(fd,0,SEEK_END);
+                printf("Session pointer at the end of the file:%lld\n",(long long)pos);
+                if(pos!=SPARSE_SIZE){
+                        printf("Wrong size of the file in session: expected %lld\n",(long long)SPARSE_SIZE);
+                        return EINVAL;
+                }
+                for(i=0;i<CHUNKS;i++){
+                        memset(chunk,'a'+i,CHUNK_SIZE);
+                        ret=write(fd,chunk,CHUNK_SIZE);
+                        if(ret!=CHUNK_SIZE){
+                                printf("Could not write into session because of error:%d\n",errno);
+                                return errno;
+                        }
+                        printf("%d bytes written into session, session pointer:%lld\n",ret,(long long)lseek(fd,0,SEEK_CUR));
+                }
+                printf("Now closing session\n");
+                if(close(fd)){
+                        printf("Could not close session because of error:%d\n",errno);
+                        return errno;
+                }
+
+                /*
+                 * Check the content of the file without the session semantics
+                 */
+
+                fd=open(filename,O_RDONLY);
+                if(fd<0){
+                        printf("Could not reopen file because of error:%d\n",errno);
+                        return errno;
+                }
+                pos=lseek(fd,0,SEEK_END);
+                printf("Size of the file after the session:%lld\n",(long long)pos);
+                if(pos!=SPARSE_SIZE+(off_t)CHUNKS*CHUNK_SIZE){
+                        printf("Wrong size of the file after the session\n");
+                        return EIO;
+                }
+                for(i=0;i<CHUNKS;i++){
+                        memset(chunk,'a'+i,CHUNK_SIZE);
+                        ret=pread(fd,check,CHUNK_SIZE,SPARSE_SIZE+(off_t)i*CHUNK_SIZE);
+                        if(ret!=CHUNK_SIZE||memcmp(chunk,check,CHUNK_SIZE)){
+                                printf("Wrong content at offset %lld\n",(long long)(SPARSE_SIZE+(off_t)i*CHUNK_SIZE));
+                                return EIO;
+                        }
+                }
+                close(fd);
+                printf("Content past the 8 GB mark correctly committed\n");
+                free(chunk);
+                free(check);
+                return 0;
+        }
+        printf("Invalid arguments: provide absolute filepath of the file to be created as first parameter\n");
+        return EINVAL;
+}
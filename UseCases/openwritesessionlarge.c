@@ -0,0 +1,158 @@
+#define _FILE_OFFSET_BITS 64
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define SESSION_OPEN 00000004
+
+/*
+ * The file is made sparse up to 1 MB before the 8 GB mark and opened in a regular
+ * (read-write) session: a chunk is written across the 8 GB mark, leaving a gap past
+ * the original end of the file, and another one at an unaligned offset past it.
+ * Both are read back within the session, then the session is committed and the
+ * content of the file is checked
+ */
+
+#define SPARSE_SIZE ((8LL<<30)-(1LL<<20))
+#define CHUNK_SIZE (1<<20)
+#define CHUNKS 2
+
+/*
+ * Offsets of the chunks written in session, and end of the gap left by the first
+ * one past the original end of the file
+ */
+
+const off_t offsets[CHUNKS]={(8LL<<30)-(CHUNK_SIZE/2),(8LL<<30)+(1LL<<20)+123};
+#define GAP_END ((8LL<<30)-(CHUNK_SIZE/2))
+
+/*
+ * Read "size" bytes at "pos" and check that they are all equal to "c"
+ */
+
+int check_bytes(int fd, char* check, off_t pos, size_t size, char c){
+        size_t i;
+        if(lseek(fd,pos,SEEK_SET)!=pos||read(fd,check,size)!=(ssize_t)size)
+                return 0;
+        for(i=0;i<size;i++)
+                if(check[i]!=c)
+                        return 0;
+        return 1;
+}
+
+int main(int argc, char** argv){
+        int fd,ret,i;
+        off_t pos;
+        const char* filename;
+        char* chunk;
+        char* check;
+        if(argc>1){
+                filename = argv[1];
+                chunk=malloc(CHUNK_SIZE);
+                check=malloc(CHUNK_SIZE);
+                if(!chunk||!check){
+                        printf("Not enough memory for the test buffers\n");
+                        return ENOMEM;
+                }
+                printf("PID of current process:%d\n",getpid());
+
+                /*
+                 * Create the sparse file without the session semantics
+                 */
+
+                printf("Creating sparse file %s of %lld bytes\n",filename,(long long)SPARSE_SIZE);
+                fd=open(filename,O_WRONLY|O_CREAT|O_TRUNC,0644);
+                if(fd<0||ftruncate(fd,SPARSE_SIZE)){
+                        printf("Could not create sparse file because of error:%d\n",errno);
+                        return errno;
+                }
+                close(fd);
+
+                /*
+                 * Open a regular session on the file and write the chunks past the
+                 * 8 GB mark
+                 */
+
+                printf("Opening file using session semantics\n");
+                fd=open(filename,O_RDWR|SESSION_OPEN);
+                if(fd<0) {
+                        printf("Error while opening session:%d\n",errno);
+                        return errno;
+                }
+                for(i=0;i<CHUNKS;i++){
+                        pos=lseek(fd,offsets[i],SEEK_SET);
+                        if(pos!=offsets[i]){
+                                printf("Could not move session pointer to %lld because of error:%d\n",(long long)offsets[i],errno);
+                                return errno;
+                        }
+                        memset(chunk,'a'+i,CHUNK_SIZE);
+                        ret=write(fd,chunk,CHUNK_SIZE);
+                        if(ret!=CHUNK_SIZE){
+                                printf("Could not write into session because of error:%d\n",errno);
+                                return errno;
+                        }
+                        printf("%d bytes written into session at offset %lld\n",ret,(long long)pos);
+                }
+                pos=lseek(fd,0,SEEK_END);
+                printf("Size of the file in session:%lld\n",(long long)pos);
+                if(pos!=offsets[CHUNKS-1]+CHUNK_SIZE){
+                        printf("Wrong size of the file in session: expected %lld\n",(long long)(offsets[CHUNKS-1]+CHUNK_SIZE));
+                        return EINVAL;
+                }
+
+                /*
+                 * Read the chunks back within the session, as well as the gap left
+                 * past the original end of the file
+                 */
+
+                for(i=0;i<CHUNKS;i++)
+                        if(!check_bytes(fd,check,offsets[i],CHUNK_SIZE,'a'+i)){
+                                printf("Wrong content in session at offset %lld\n",(long long)offsets[i]);
+                                return EIO;
+                        }
+                if(!check_bytes(fd,check,SPARSE_SIZE,GAP_END-SPARSE_SIZE,0)){
+                        printf("Wrong content in session at offset %lld\n",(long long)SPARSE_SIZE);
+                        return EIO;
+                }
+                printf("Now closing session\n");
+                if(close(fd)){
+                        printf("Could not close session because of error:%d\n",errno);
+                        return errno;
+                }
+
+                /*
+                 * Check the content of the file without the session semantics
+                 */
+
+                fd=open(filename,O_RDONLY);
+                if(fd<0){
+                        printf("Could not reopen file because of error:%d\n",errno);
+                        return errno;
+                }
+                pos=lseek(fd,0,SEEK_END);
+                printf("Size of the file after the session:%lld\n",(long long)pos);
+                if(pos!=offsets[CHUNKS-1]+CHUNK_SIZE){
+                        printf("Wrong size of the file after the session\n");
+                        return EIO;
+                }
+                for(i=0;i<CHUNKS;i++)
+                        if(!check_bytes(fd,check,offsets[i],CHUNK_SIZE,'a'+i)){
+                                printf("Wrong content at offset %lld\n",(long long)offsets[i]);
+                                return EIO;
+                        }
+                if(!check_bytes(fd,check,SPARSE_SIZE,GAP_END-SPARSE_SIZE,0)||
+                   !check_bytes(fd,check,offsets[0]+CHUNK_SIZE,offsets[1]-offsets[0]-CHUNK_SIZE,0)){
+                        printf("Wrong content between the chunks\n");
+                        return EIO;
+                }
+                close(fd);
+                printf("Content past the 8 GB mark correctly written, read back and committed\n");
+                free(chunk);
+                free(check);
+                return 0;
+        }
+        printf("Invalid arguments: provide absolute filepath of the file to be created as first parameter\n");
+        return EINVAL;
+}
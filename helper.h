@@ -15,8 +15,16 @@ unsigned long* system_call_table;
 
 unsigned long* original_open;
 
-asmlinkage long (*truncate_call)(const char * path, long length);
+/*
+ * Addresses of the original system calls "ftruncate" and "fallocate"
+ */
+
+unsigned long* original_ftruncate;
+unsigned long* original_fallocate;
+
 asmlinkage long (*previous_open)(const char __user* filename,int flags,int mode);
+asmlinkage long (*previous_ftruncate)(unsigned int fd, unsigned long length);
+asmlinkage long (*previous_fallocate)(int fd, int mode, loff_t offset, loff_t len);
 
 /*
  * Find address of the system call table
@@ -65,14 +65,26 @@ int init_module(void) {
          */
 
         original_open=system_call_table[__NR_open];
-        truncate_call=system_call_table[__NR_truncate];
         previous_open=system_call_table[__NR_open];
 
         /*
-         * Replace original system call "open" with a custom version of it
+         * Do the same for "ftruncate" and "fallocate", which act on the session
+         * buffer when they are invoked on a file in session
+         */
+
+        original_ftruncate=system_call_table[__NR_ftruncate];
+        previous_ftruncate=system_call_table[__NR_ftruncate];
+        original_fallocate=system_call_table[__NR_fallocate];
+        previous_fallocate=system_call_table[__NR_fallocate];
+
+        /*
+         * Replace original system call "open" with a custom version of it, and
+         * the same for "ftruncate" and "fallocate"
          */
 
         system_call_table[__NR_open]=(unsigned long)sys_session_open;
+        system_call_table[__NR_ftruncate]=(unsigned long)sys_session_ftruncate;
+        system_call_table[__NR_fallocate]=(unsigned long)sys_session_fallocate;
 
         /*
          * Restore original value of register CR0
@@ -100,6 +112,37 @@ int init_module(void) {
 
         sessions_list_init(sessions_list);
 
+        /*
+         * Find the functions charging session pages to memory cgroups
+         */
+
+        session_memcg_init();
+
+        /*
+         * Set up the pools of recycled pages of the session buffers
+         */
+
+        session_pool_init();
+        session_reclaim_init();
+
+        /*
+         * Start compressing the session pages which are not accessed anymore
+         */
+
+        session_compress_init();
+
+        /*
+         * Start writing the idle sessions into their shadow files
+         */
+
+        session_shadow_init();
+
+        /*
+         * Export the statistics of the session semantics
+         */
+
+        session_stats_init();
+
         /*
          * Log message about our just inserted module
          */
@@ -131,6 +174,8 @@ void cleanup_module(void) {
          */
 
         system_call_table[__NR_open]=original_open;
+        system_call_table[__NR_ftruncate]=original_ftruncate;
+        system_call_table[__NR_fallocate]=original_fallocate;
 
         /*
          * Restore value of register CR0
@@ -138,12 +183,42 @@ void cleanup_module(void) {
 
         enable_write_protected_mode(&cr0);
 
+        /*
+         * Stop releasing pages of the session buffers under memory pressure
+         */
+
+        session_reclaim_remove();
+
+        /*
+         * Stop compressing the pages of the session buffers
+         */
+
+        session_compress_remove();
+
+        /*
+         * Stop writing the idle sessions into their shadow files
+         */
+
+        session_shadow_remove();
+
+        /*
+         * Remove the statistics of the session semantics
+         */
+
+        session_stats_remove();
+
         /*
          * Remove the data structures associated to the session semantics
          */
 
         sessions_remove();
 
+        /*
+         * Give back the pages kept in the pools of recycled pages
+         */
+
+        session_pool_remove();
+
         printk(KERN_INFO "Module \"session_module\" removed: restored system call table\n");
 
 }
@@ -19,521 +19,5070 @@
 #include <linux/swap.h>
 #include <linux/slab.h>
 #include <linux/fcntl.h>
+#include <linux/falloc.h>
+#include <linux/moduleparam.h>
+#include <linux/nodemask.h>
+#include <linux/topology.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/kallsyms.h>
+#include <linux/memcontrol.h>
+#include <linux/crypto.h>
+#include <linux/lzo.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/jhash.h>
+#include <linux/xattr.h>
+#include <linux/smp_lock.h>
 #include "session.h"
 
-extern asmlinkage long (*truncate_call)(const char *path, long length);
 extern struct file* get_file_from_descriptor(int fd);
 
 /*
- * NEW BUFFER PAGE - start
- *
- * Create a new object of type "buffer_page" to keep track of pages of
- * the session buffer
- *
- * @buffer_page_descriptor: pointer to the descriptor associate to the allocated
- * frame
- * @index: index of the page within the buffer
- *
- * Returns a pointer to the new instance of buffer_page if successful, -ENOMEM if
- * not enough memory is available for the creation of the new object and -EINVAL
- * if one of the given pointer is NULL
+ * MODULE PARAMETERS - start
  */
 
-struct buffer_page* session_new_buffer_page(void* buffer_page_address,struct page* buffer_page_descriptor,int index){
+/*
+ * If set, the bytes belonging to a run of contiguous pages of the session buffer
+ * are copied to and from user-space with a single operation, otherwise they are
+ * copied one page at a time
+ */
 
-        /*
-         * Pointer to the new buffer_page object
-         */
+int session_run_copy = 1;
+module_param(session_run_copy, int, 0644);
+MODULE_PARM_DESC(session_run_copy, "Copy runs of contiguous session pages with a single operation (default 1)");
 
-        struct buffer_page* buffer_page;
+/*
+ * Writes into the session of at least this number of bytes copy data from user-space
+ * bypassing the CPU cache, where the architecture provides non-temporal stores; 0
+ * disables cache-bypassing copies
+ */
 
-        printk(KERN_INFO "SESSION SEMANTICS->Creating buffer page for address %lu and descriptor %lu, with index %d\n",buffer_page_address,buffer_page_descriptor,index);
+int session_nocache_threshold = 1 << 20;
+module_param(session_nocache_threshold, int, 0644);
+MODULE_PARM_DESC(session_nocache_threshold, "Minimum size in bytes of a write copied bypassing the CPU cache, 0 to disable (default 1MB)");
 
-        /*
-         * Check if provided addresses are valid: if not, return -EFAULT
-         */
+/*
+ * Sessions whose buffer grows to at least this number of MB get their blocks of
+ * pages spread round-robin over the online NUMA nodes, rather than allocated on the
+ * node of the CPU which opened the session; 0 disables interleaving
+ */
 
-        if((!buffer_page_address)||(!buffer_page_descriptor))
-                return ERR_PTR(-EFAULT);
+int session_interleave_mb = 0;
+module_param(session_interleave_mb, int, 0644);
+MODULE_PARM_DESC(session_interleave_mb, "Size in MB from which session buffers are interleaved over NUMA nodes, 0 to disable (default 0)");
 
-        /*
-         * Check if provided index is valid: if not, return -EINVAL
-         */
+/*
+ * The session buffer is sized to the bytes it has to store plus at most this
+ * number of KB, left to accommodate further writes; the pages of a block beyond
+ * this margin are released as soon as the block is allocated
+ */
 
-        if(index<0)
-                return ERR_PTR(-EINVAL);
+int session_growth_kb = 64;
+module_param(session_growth_kb, int, 0644);
+MODULE_PARM_DESC(session_growth_kb, "Maximum number of KB allocated to a session buffer beyond the requested size (default 64)");
 
-        /*
-         * Allocate a new object of type "buffer_page"
-         */
+/*
+ * Sessions whose content is at most this number of bytes keep it inline in a slab
+ * object sized to the content, rather than in a whole page; the content is moved
+ * into pages as soon as it outgrows this limit. 0 disables inline storage
+ */
 
-        buffer_page=kmalloc(sizeof(struct buffer_page),GFP_KERNEL);
+int session_inline_max = 2048;
+module_param(session_inline_max, int, 0644);
+MODULE_PARM_DESC(session_inline_max, "Maximum size in bytes of a session stored inline, 0 to disable (default 2048)");
 
-        /*
-         * Check if allocation was successful: if not return -ENOMEM
-         */
+/*
+ * Maximum number of pages released by session buffers that each CPU keeps for
+ * reuse by new session buffers; 0 disables the recycling of pages
+ */
 
-        if(!buffer_page)
-                return ERR_PTR(-ENOMEM);
+int session_pool_pages = 256;
+module_param(session_pool_pages, int, 0644);
+MODULE_PARM_DESC(session_pool_pages, "Maximum number of recycled session pages kept by each CPU, 0 to disable (default 256)");
 
-        /*
-         * Set the descriptor and address of the buffer page
-         */
+/*
+ * Runs of pages of the session buffers which are not accessed for this number of
+ * seconds are compressed, and decompressed as soon as they are accessed again; 0
+ * disables compression
+ */
 
-        buffer_page->buffer_page_address=buffer_page_address;
-        buffer_page->buffer_page_descriptor=buffer_page_descriptor;
+int session_compress_secs = 0;
+module_param(session_compress_secs, int, 0644);
+MODULE_PARM_DESC(session_compress_secs, "Seconds after which idle session pages are compressed, 0 to disable (default 0)");
 
-        /*
-         * Set the index of the buffer_page
-         */
+/*
+ * If set, the pages of a session are given to the page cache of the file when
+ * the session is closed, rather than copied into it by the legacy "write"
+ */
 
-        buffer_page->index=index;
+int session_donate_pages = 1;
+module_param(session_donate_pages, int, 0644);
+MODULE_PARM_DESC(session_donate_pages, "Give session pages to the page cache on close instead of copying them (default 1)");
 
-        /*
-         * Initialize the "list_head" field
-         */
+/*
+ * If set, the pages read from the file when a session is opened are hashed, and
+ * the commit of a session writes in place only the pages whose content differs
+ * from the original one, rather than rewriting the whole file
+ */
 
-        INIT_LIST_HEAD(&buffer_page->buffer_pages_head);
+int session_skip_unchanged = 1;
+module_param(session_skip_unchanged, int, 0644);
+MODULE_PARM_DESC(session_skip_unchanged, "Write back only the session pages whose content changed (default 1)");
 
-        /*
-         * Return the pointer to allocated address
-         */
+/*
+ * Commits writing at least this number of KB into the original file allocate its
+ * blocks in advance, with a single "fallocate" for each range of contiguous data;
+ * 0 disables preallocation
+ */
 
-        printk(KERN_INFO "SESSION SEMANTICS->Created buffer page %d, corresponding to virtual address %lu\n",buffer_page->index,buffer_page->buffer_page_address);
-        return buffer_page;
-}
+int session_prealloc_kb = 256;
+module_param(session_prealloc_kb, int, 0644);
+MODULE_PARM_DESC(session_prealloc_kb, "Minimum size in KB of a commit whose blocks are preallocated, 0 to disable (default 256)");
 
 /*
- * NEW BUFFER PAGE - end
+ * Sessions which are going to rewrite the whole file and are not accessed for this
+ * number of seconds get their pages written into a shadow file in the background,
+ * which replaces the original file when the session is closed; 0 disables shadow
+ * files
  */
 
+int session_shadow_secs = 0;
+module_param(session_shadow_secs, int, 0644);
+MODULE_PARM_DESC(session_shadow_secs, "Seconds after which idle sessions are written into a shadow file, 0 to disable (default 0)");
+
 /*
- * CREATE SESSION BUFFER - start
+ * Maximum number of milliseconds the files of the sessions being closed wait for
+ * each other, so that they are synchronized with the device together; 0 disables
+ * group commit
+ */
+
+int session_group_commit_ms = 0;
+module_param(session_group_commit_ms, int, 0644);
+MODULE_PARM_DESC(session_group_commit_ms, "Maximum wait in milliseconds for sessions synchronized together on close, 0 to disable (default 0)");
+
+/*
+ * MODULE PARAMETERS - end
+ */
+
+/*
+ * MEMORY CGROUP ACCOUNTING - start
  *
- * Allocate a suitable number of pages to store the content of the file in
- * session
+ * The pages of the session buffers are charged to the memory cgroup of the task
+ * which allocates them (the one opening or writing the session), like the pages
+ * of the page cache, so that the limits of the cgroup cover the sessions too. The
+ * pages are uncharged as they leave the buffer: when the session is removed,
+ * before they are kept for reuse (see "session_pool_put") and when they are
+ * released by the shrinker. The content written by the commit goes through the
+ * page cache, where it's charged as usual.
+ *
+ * The charging functions of the memory controller are not exported to modules,
+ * so their addresses are looked up when the module is inserted; if they can't be
+ * found, the pages are not accounted
+ */
+
+int (*session_memcg_charge)(struct page *page, struct mm_struct *mm, gfp_t gfp_mask);
+void (*session_memcg_uncharge)(struct page *page);
+
+/*
+ * Look up the charging functions of the memory controller
+ */
+
+void session_memcg_init(void){
+#if (defined CONFIG_KALLSYMS) && (defined CONFIG_CGROUP_MEM_RES_CTLR)
+        session_memcg_charge = (void *) kallsyms_lookup_name("mem_cgroup_cache_charge");
+        session_memcg_uncharge = (void *) kallsyms_lookup_name("mem_cgroup_uncharge_cache_page");
+#endif
+        if (!session_memcg_charge || !session_memcg_uncharge) {
+                session_memcg_charge = NULL;
+                session_memcg_uncharge = NULL;
+                printk(KERN_INFO "SESSION SEMANTICS->Session pages are not charged to memory cgroups\n");
+        }
+}
+
+/*
+ * Charge a run of pages to the memory cgroup of the current task
  *
- * @filesize: size of the opened file
- * @filename: filename of the file
- * @order: pointer to the order variable, that has to be set to the order of
- * pages allocated
+ * @first: descriptor of the first page of the run
+ * @nr_pages: number of pages of the run
  *
- * Returns the pointer to the descriptor of the first page of the buffer,NULL
- * if not enough memory is available
+ * Returns 0 if successful, -ENOMEM if the cgroup is over its limit
  */
 
-struct page* session_create_buffer(int filesize,const char __user *filename,int* order){
+int session_charge_pages(struct page *first, unsigned long nr_pages){
 
         /*
-         * Pointer to the descriptor of the first page in the buffer allocated to
-         * read the file
+         * Index to iterate through the pages of the run
          */
 
-        struct page *first_page;
+        unsigned long i;
 
         /*
-         * Check size of the file
+         * Return value
          */
 
-        if (!filesize) {
-
-                /*
-                 * File is empty, allocate only one page; order is 0
-                 */
+        int ret;
 
-                printk(KERN_INFO "SESSION SEMANTICS-> File \"%s\" has size 0\n",filename);
-                first_page = alloc_pages(GFP_KERNEL, 0);
-                *order=0;
+        if (!session_memcg_charge)
+                return 0;
+        for (i = 0; i < nr_pages; i++) {
+                ret = session_memcg_charge(first + i, current->mm, GFP_KERNEL);
+                if (ret) {
+                        while (i--)
+                                session_memcg_uncharge(first + i);
+                        printk(KERN_INFO "SESSION SEMANTICS->Memory cgroup refused %lu session pages\n", nr_pages);
+                        return ret;
+                }
         }
-        else{
-
-                /*
-                 * File is not empty, so allocate as many pages as
-                 * necessary to store the actual size of the file
-                 */
-
-                /*
-                 * Get the order of pages to be allocated using alloc_pages
-                 */
-
-                *order = get_order(filesize);
+        return 0;
+}
 
-                /*
-                 * Get 2^order free pages to store the content of the opened file
-                 */
+/*
+ * Uncharge a run of pages from the memory cgroup they were charged to; the
+ * pages must not be associated to an address_space
+ *
+ * @first: descriptor of the first page of the run
+ * @nr_pages: number of pages of the run
+ */
 
-                first_page = alloc_pages(GFP_KERNEL, *order);
-        }
+void session_uncharge_pages(struct page *first, unsigned long nr_pages){
 
         /*
-         * Return pointer to descriptor of the first page
+         * Index to iterate through the pages of the run
          */
 
-        return first_page;
+        unsigned long i;
+
+        if (!session_memcg_uncharge)
+                return;
+        for (i = 0; i < nr_pages; i++)
+                session_memcg_uncharge(first + i);
 }
 
 /*
- * CREATE SESSION BUFFER - end
+ * MEMORY CGROUP ACCOUNTING - end
  */
 
 /*
- * FILL SESSION BUFFER - start
- *
- * Copy the content of the opened file into the session buffer, page by page,
- * until a number of bytes equal to the filesize has been transferred. At each
- * the function "readpage", from the address_space of the file, is used to
- * transfer data from the device where the file is stored to the page frame
+ * SESSION PAGE POOL - start
  *
- * @first_page: pointer to the descriptor of the first page in the buffer
- * @mapping: pointer to "address_space" structure of the file, containing
- * pointers to functions to be used for low level I/O operations related to
- * the file
- * @order: 2^order pages belong to the buffer
- * @opened_file: file structure associated to opened file
+ * Pages released by the session buffers are kept in a per-CPU pool, rather than
+ * being given back to the buddy allocator, so that sessions which are opened and
+ * closed at a high rate recycle the same pages without taking the zone lock. Each
+ * CPU only keeps pages of its own NUMA node, up to "session_pool_pages" pages, and
+ * the pools are drained by a shrinker when the system runs short of memory.
  *
- * Returns 0 if the whole file is copied, an error code otherwise
+ * The pool stores runs of contiguous pages, as they were released by the session
+ * buffers: a run is linked to the pool through the field "lru" of its first page,
+ * and the number of pages in the run is kept in the field "private" of the same
+ * page, so the pool needs no memory of its own
  */
 
-int session_fill_buffer(struct page* first_page,int order,struct file *opened_file){
+/*
+ * Pool of recycled pages of a CPU
+ *
+ * lock: spinlock protecting the pool, which can be drained by the shrinker from
+ * any CPU
+ *
+ * runs: list of the runs of pages in the pool
+ *
+ * nr_pages: number of pages in the pool
+ */
 
-        /*
-         * This structure contains pointers to the functions used by the VFS layer
-         * in order to ask the I/O block layer to transfer data to and from devices
-         */
+struct session_pool {
+        spinlock_t lock;
+        struct list_head runs;
+        unsigned long nr_pages;
+};
 
-        struct address_space *mapping;
+DEFINE_PER_CPU(struct session_pool, session_pools);
 
-        /*
-         * Return value
-         */
+/*
+ * Take a run of at most "want" pages of the given NUMA node from the pool of the
+ * current CPU; if the first run of the node in the pool is longer, only its first
+ * "want" pages are taken and the others stay in the pool
+ *
+ * @node: NUMA node the pages must belong to
+ * @want: maximum number of pages to be taken
+ * @first: set to the descriptor of the first page taken
+ *
+ * Returns the number of pages taken, 0 if the pool has no page of the node
+ */
 
-        int ret;
+unsigned long session_pool_get(int node, unsigned long want, struct page **first){
 
         /*
-         * Pointer to the page descriptor of the allocated pages; this is
-         * used in the iteration to initialize the session buffer
+         * Pool of the current CPU
          */
 
-        struct page *page;
+        struct session_pool *pool;
 
         /*
-         * Index used to iterate through allocated pages
+         * Run of pages used in the iteration
          */
 
-        int i;
+        struct page *run;
 
         /*
-         * Get the address_space structure of the opened file
+         * Number of pages taken from the pool
          */
 
-        mapping = opened_file->f_mapping;
+        unsigned long taken;
 
         /*
-         * Copy the content of the opened file into the session buffer, page by page,
-         * until a number of bytes equal to the filesize has been transferred. At each
-         * the function "readpage", from the address_space of the file, is used to
-         * transfer data from the device where the file is stored to the page frame
+         * Index to iterate through the pages taken
          */
 
-        page = first_page;
-        for (i = 0; i < (1 << order); i++) {
-
-                /*
-                 * Lock the page before accessing it
-                 */
-
-                __set_page_locked(page);
+        unsigned long i;
 
-                /*
-                 * Initialize the address_space structure of the new
-                 * page to the one of the opened file; also set its
-                 * index field, which represents the offset of the page
-                 * with respect to the beginning of the file (in terms
-                 * of pages)
-                 */
-
-                page->mapping = mapping;
-                page->index = i;
+        taken = 0;
+        pool = &get_cpu_var(session_pools);
+        spin_lock(&pool->lock);
+        list_for_each_entry(run, &pool->runs, lru) {
+                if (page_to_nid(run) != node)
+                        continue;
+                taken = min(want, page_private(run));
 
                 /*
-                 * Copy the content of the file to the newly allocated pages
-                 * using the readpage: this is a low-level function which wraps
-                 * the function provided by the filesystem to read the content
-                 * of its files into memory
-                 *
-                 * This function creates an instance of the "struct bio" which
-                 * represents an I/O request to a block device (like an hard disk)
-                 * and submits this request to the controller of the device
-                 *
-                 * The function returns 0 when the request is successfully submitted:
-                 * if this it not the case, we return the error code -EIO (I/O error)
-                 * and release the allocated pages, although this should be unlikely.
-                 * Also release the lock on the open file table of the current process
+                 * Leave the pages of the run which are not taken in the pool
                  */
 
-                ret = mapping->a_ops->readpage(opened_file, page);
-                if (ret) {
-
-                        /*
-                         * Return error
-                         */
-
-                        printk(KERN_INFO "SESSION SEMANTICS->Filling buffer returned error:%d\n",ret);
-                        return ret;
+                if (taken < page_private(run)) {
+                        set_page_private(run + taken, page_private(run) - taken);
+                        list_add(&run[taken].lru, &run->lru);
                 }
+                list_del(&run->lru);
+                set_page_private(run, 0);
+                pool->nr_pages -= taken;
+                *first = run;
+                break;
+        }
+        spin_unlock(&pool->lock);
+        put_cpu_var(session_pools);
 
-                /*
-                 * When the I/O request to the device has been successfully completed,
-                 * the bit "PG_uptodate" in the flag of the page descriptor is set.
-                 * Also, when the I/O request has been completed, the PG_locked bit in
-                 * the flag of the page is cleared => in order to be sure that our I/O
-                 * has been completed, the process goes to sleep using the value of the
-                 * bit as condition => the process is woken up when the page gets unlocked.
-                 * We use the function "lock_page_killable" to implement this mechanism
-                 */
-
-                if (!PageUptodate(page)) {
-                        ret = lock_page_killable(page);
-
-                        /*
-                         * When the process is woken up we check the response of the I/O
-                         * request: in case of error release the pages and return -EIO
-                         * Also release the lock on the open file table of the current
-                         * process
-                         */
-
-                        if (ret) {
-
-                                /*
-                                 * Return error
-                                 */
+        /*
+         * The content of recycled pages is not valid for the new buffer
+         */
 
-                                printk(KERN_INFO "SESSION SEMANTICS->Filling buffer returned error:%d\n",ret);
-                                return ret;
-                        }
+        for (i = 0; i < taken; i++) {
+                ClearPageUptodate(*first + i);
+                ClearPageDirty(*first + i);
+        }
+        return taken;
+}
 
-                        /*
-                         * Unlock the page and wake up other processes waiting to access
-                         * the page (if any)
-                         */
+/*
+ * Give a run of pages released by a session buffer to the pool of the current
+ * CPU; the run is refused if its pages don't belong to the NUMA node of the CPU
+ * or if the pool is full
+ *
+ * @first: descriptor of the first page of the run
+ * @nr_pages: number of pages of the run
+ *
+ * Returns true if the pool took the pages, false if the caller has to release them
+ */
 
-                        unlock_page(page);
-                }
+bool session_pool_put(struct page *first, unsigned long nr_pages){
 
-                /*
-                 * Go to next page
-                 */
+        /*
+         * Pool of the current CPU
+         */
 
-                page += 1;
-        }
+        struct session_pool *pool;
 
         /*
-         * The content of the file was fully copied from its storage into the session
-         * without making use of the buffer, so return 0
+         * Whether the pool took the pages
          */
 
-        printk(KERN_INFO "SESSION SEMANTICS->Filling buffer was successfull\n");
-        return 0;
-}
+        bool taken;
 
-/*
- * FILL SESSION BUFFER - end
- */
+        if (session_pool_pages <= 0)
+                return false;
+        taken = false;
+        pool = &get_cpu_var(session_pools);
+        if (page_to_nid(first) == numa_node_id()) {
+                spin_lock(&pool->lock);
+                if (pool->nr_pages + nr_pages <= (unsigned long) session_pool_pages) {
+                        set_page_private(first, nr_pages);
+                        list_add(&first->lru, &pool->runs);
+                        pool->nr_pages += nr_pages;
+                        taken = true;
+                }
+                spin_unlock(&pool->lock);
+        }
+        put_cpu_var(session_pools);
+        return taken;
+}
 
 /*
- * EXPAND SESSION BUFFER - start
- *
- * Ask the system for the allocation of new pages, map them and add them to
- * the buffer of the session object
+ * Give back to the buddy allocator up to "nr_to_scan" pages kept in the pools of
+ * all the CPUs; whole runs are released, so a few more pages may be released
  *
- * @session: pointer to the object representing the current session
- * @size: number of additional bytes that don't fit into the actual size of
- * the buffer
+ * @nr_to_scan: number of pages to be released
  *
- * Returns the number of pages added if succeeds, -ENOMEM if not enough memory
- * is available for the creation of the new object and -EINVAL if the given
- * pointer is NULL
+ * Returns the number of pages released
  */
 
-int session_expand_buffer(struct session* session, int size){
+unsigned long session_pool_drain(unsigned long nr_to_scan){
 
         /*
-         * 2^(new_order) new pages have to be allocated to
-         * the buffer
+         * CPU whose pool is drained
          */
 
-        int new_order;
+        int cpu;
 
         /*
-         * Index to iterate through newly allocated pages
+         * Pool of the CPU
          */
 
-        int i;
+        struct session_pool *pool;
 
         /*
-         * Virtual address of newly allocated pages of the buffer
+         * Run of pages released
          */
 
-        void* new_va;
+        struct page *run;
 
         /*
-         * Pointer to the descriptor of the first newly allocated page
+         * Number of pages of the run
          */
 
-        struct page* new_first;
+        unsigned long nr_pages;
 
         /*
-         * Check if parameters are valid
+         * Number of pages released
          */
 
-        if((!session)||(!size)){
+        unsigned long released;
 
-                /*
-                 * Return -EINVAL if the session object is not set or size is 0
-                 */
+        /*
+         * Index to iterate through the pages of the run
+         */
 
-                if (!session) {
-                        printk(KERN_INFO "SESSION SEMANTICS->session_expand_buffer: session is NULLL\n", -EINVAL);
-                        return -EINVAL;
-                }
-                if (!session) {
-                        printk(KERN_INFO "SESSION SEMANTICS->session_expand_buffer was passed 0 size\n");
-                        return -EINVAL;
+        unsigned long i;
+
+        released = 0;
+        for_each_possible_cpu(cpu) {
+                pool = &per_cpu(session_pools, cpu);
+                while (released < nr_to_scan) {
+                        spin_lock(&pool->lock);
+                        if (list_empty(&pool->runs)) {
+                                spin_unlock(&pool->lock);
+                                break;
+                        }
+                        run = list_first_entry(&pool->runs, struct page, lru);
+                        list_del(&run->lru);
+                        nr_pages = page_private(run);
+                        pool->nr_pages -= nr_pages;
+                        spin_unlock(&pool->lock);
+                        set_page_private(run, 0);
+                        for (i = 0; i < nr_pages; i++)
+                                __free_page(run + i);
+                        released += nr_pages;
                 }
         }
+        return released;
+}
 
-        /*
-         * Get the order of pages necessary to store the requested amount of bytes
-         */
+/*
+ * Shrinker of the pools: when asked for it, release the requested number of
+ * pages, then report how many pages are still kept in the pools
+ *
+ * @nr_to_scan: number of pages to be released, 0 to just get the number of pages
+ * in the pools
+ * @gfp_mask: allocation flags of the caller
+ *
+ * Returns the number of pages in the pools
+ */
 
-        new_order=get_order((loff_t)size);
+int session_pool_shrink(int nr_to_scan, gfp_t gfp_mask){
 
         /*
-         * Allocated requested pages
+         * CPU whose pool is counted
          */
 
-        new_first=alloc_pages(GFP_KERNEL,new_order);
+        int cpu;
 
         /*
-         * Map the newly allocated pages into the virtual address
+         * Number of pages in the pools
          */
 
-        new_va=kmap(new_first);
+        unsigned long nr_pages;
+
+        if (nr_to_scan > 0)
+                session_pool_drain((unsigned long) nr_to_scan);
+        nr_pages = 0;
+        for_each_possible_cpu(cpu)
+                nr_pages += per_cpu(session_pools, cpu).nr_pages;
+        return (int) min_t(unsigned long, nr_pages, INT_MAX);
+}
+
+struct shrinker session_pool_shrinker = {
+        .shrink = session_pool_shrink,
+        .seeks = DEFAULT_SEEKS,
+};
+
+/*
+ * Initialize the pools of all the CPUs and register their shrinker
+ */
+
+void session_pool_init(void){
 
         /*
-         * Create an object "buffer_page" for each newly allocated page and add
-         * it to the buffer of the session
+         * CPU whose pool is initialized
          */
 
-        for(i=0;i<(1<<new_order);i++){
+        int cpu;
 
-                /*
-                 * Pointer to the new buffer_page object
-                 */
-
-                struct buffer_page* buffer_page;
+        for_each_possible_cpu(cpu) {
+                spin_lock_init(&per_cpu(session_pools, cpu).lock);
+                INIT_LIST_HEAD(&per_cpu(session_pools, cpu).runs);
+                per_cpu(session_pools, cpu).nr_pages = 0;
+        }
+        register_shrinker(&session_pool_shrinker);
+}
 
-                /*
-                 * Create a new "buffer_page" object for each new page of the buffer
-                 */
+/*
+ * Unregister the shrinker of the pools and release all the pages they keep
+ */
 
-                buffer_page=session_new_buffer_page(new_va+i*PAGE_SIZE,new_first+i,session->nr_pages+i);
+void session_pool_remove(void){
+        unregister_shrinker(&session_pool_shrinker);
+        session_pool_drain(ULONG_MAX);
+}
 
-                /*
-                 * Check if the creation of the new object was successful: if not,
-                 * return the associated error code
-                 */
+/*
+ * SESSION PAGE POOL - end
+ */
 
-                if(IS_ERR_VALUE(PTR_ERR(buffer_page)))
-                        return PTR_ERR(buffer_page);
+/*
+ * SESSION STATISTICS - start
+ *
+ * Counters exported through the file /proc/session_stats, together with the
+ * memory used by each active session
+ */
 
-                /*
-                 * Add the newly created object to the corresponding list in the session
-                 * object
-                 */
+/*
+ * Number of pages of session buffers allocated on each NUMA node
+ */
 
-                printk(KERN_INFO "SESSION SEMANTICS->Adding buffer page %d to session\n",buffer_page->index);
-                list_add_tail(&buffer_page->buffer_pages_head,&(session->pages));
-        }
+atomic_long_t session_node_pages[MAX_NUMNODES];
 
-        /*
-         * Buffer was successfully expanded, so return number of new pages
-         */
+/*
+ * Number of bytes of the runs of pages currently compressed, and number of bytes
+ * their compressed content takes
+ */
 
-        return (1<<new_order);
-}
+atomic_long_t session_compressed_bytes;
+atomic_long_t session_compressed_size;
 
 /*
- * EXPAND SESSION BUFFER - end
+ * Number of runs of pages decompressed so far, and total time in nanoseconds
+ * spent decompressing them
  */
 
+atomic_long_t session_decompressions;
+atomic64_t session_decompress_ns;
+
 /*
- * REMOVE SESSION - start
+ * Print the statistics of the session semantics
  *
- * Free the buffer associated to the session, restore the original file
- * operations in the file opened and free the session object itself.
+ * @m: sequential file the statistics are printed into
+ * @v: unused
  *
- * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT; THE
- * MUTEX IS RELEASED WITHIN THIS FUNCTION
+ * Returns 0
  */
 
-void session_remove(struct session *session) {
+int session_stats_show(struct seq_file *m, void *v){
 
         /*
-         * Index to scan through the page descriptors
+         * NUMA node used in the iteration
          */
 
-        int i = 0;
+        int node;
 
         /*
-         * Pointer to barrier_page tpe, used to iterate through
-         * the pages in the buffer of the session; "temp" is
-         * used in the iteration because we are deleting entries
-         * from the list
+         * Session used in the iteration
          */
 
-        struct buffer_page* buffer_page;
-        struct buffer_page* temp;
+        struct session *session;
 
         /*
-         * Iterate through the objects of type "buffer_page" stored
-         * in the session object and for each of them:
-         *
-         * 1- set the "mapping" field of the page descriptor to NULL,
-         * otherwise "free_page" complains because the descriptor is
-         * still in use
-         *
-         * 2- release frame associated to the page
-         *
-         * 3- remove page from list of pages in session
-         *
-         * 4- release the buffer_page object itself
+         * Bytes allocated to a session buffer but not used to store its content
          */
 
-        list_for_each_entry_safe(buffer_page,temp,&session->pages,buffer_pages_head){
-                buffer_page->buffer_page_descriptor->mapping=NULL;
-                free_page(buffer_page->buffer_page_address);
-                list_del(&buffer_page->buffer_pages_head);
-                kfree(buffer_page);
-        }
+        loff_t slack;
 
         /*
-         * Restore original file operations in the opened file
+         * Total number of slack bytes of the active sessions
          */
 
-        session->file->f_op=session->f_ops_old;
+        loff_t total_slack;
 
         /*
-         * Restore the "private_data" field of the opened file
+         * Number of runs of pages decompressed so far
+         */
+
+        long decompressions;
+
+        for_each_online_node(node)
+                seq_printf(m, "node %d pages: %ld\n", node, atomic_long_read(&session_node_pages[node]));
+        seq_printf(m, "recycled pages: %d\n", session_pool_shrink(0, GFP_KERNEL));
+        seq_printf(m, "compressed bytes: %ld, stored in %ld bytes\n", atomic_long_read(&session_compressed_bytes),
+                   atomic_long_read(&session_compressed_size));
+        decompressions = atomic_long_read(&session_decompressions);
+        seq_printf(m, "decompressions: %ld, average latency %llu ns\n", decompressions,
+                   decompressions ? div64_u64(atomic64_read(&session_decompress_ns), decompressions) : 0ULL);
+
+        /*
+         * The size of the buffer and of the content of each session is read without
+         * holding its mutex, so the numbers are just a snapshot
+         */
+
+        total_slack = 0;
+        spin_lock(&sessions_list->lock);
+        list_for_each_entry(session, &sessions_list->sessions_head, link_to_list) {
+                if (session->inline_data)
+                        slack = (loff_t) session->inline_size - (session->filesize - session->base);
+                else
+                        slack = ((loff_t) (session->nr_pages - session->nr_evicted - session->nr_compressed - session->nr_holes)
+                                 << PAGE_SHIFT) - (session->filesize - session->base);
+                if (slack < 0)
+                        slack = 0;
+                total_slack += slack;
+                seq_printf(m, "session %s: pages %lu, released %lu, compressed %lu, holes %lu, inline %zu, size %lld, slack %lld\n",
+                           session->file->f_dentry->d_name.name, session->nr_pages, session->nr_evicted,
+                           session->nr_compressed, session->nr_holes, session->inline_size,
+                           session->filesize - session->base, slack);
+        }
+        spin_unlock(&sessions_list->lock);
+        seq_printf(m, "total slack: %lld\n", total_slack);
+        return 0;
+}
+
+/*
+ * Open the file of the statistics, that is printed in one go
+ */
+
+int session_stats_open(struct inode *inode, struct file *file){
+        return single_open(file, session_stats_show, NULL);
+}
+
+/*
+ * File operations of /proc/session_stats
+ */
+
+struct file_operations session_stats_fops = {
+        .owner = THIS_MODULE,
+        .open = session_stats_open,
+        .read = seq_read,
+        .llseek = seq_lseek,
+        .release = single_release,
+};
+
+/*
+ * Create the file /proc/session_stats
+ *
+ * Returns 0 if successful, -ENOMEM otherwise
+ */
+
+int session_stats_init(void){
+        if (!proc_create("session_stats", 0444, NULL, &session_stats_fops)) {
+                printk(KERN_INFO "SESSION SEMANTICS->Could not create /proc/session_stats\n");
+                return -ENOMEM;
+        }
+        return 0;
+}
+
+/*
+ * Remove the file /proc/session_stats
+ */
+
+void session_stats_remove(void){
+        remove_proc_entry("session_stats", NULL);
+}
+
+/*
+ * SESSION STATISTICS - end
+ */
+
+/*
+ * NEW BUFFER EXTENT - start
+ *
+ * Append a new run of contiguous pages to the array of runs describing the
+ * session buffer; the run is initially empty and pages are added to it as they
+ * are added to the buffer. The array is enlarged by doubling its capacity, so
+ * pointers to its elements are only valid until the next run is added
+ *
+ * @session: pointer to the object representing the current session
+ * @first_page: pointer to the descriptor of the first page of the run
+ * @address: virtual address of the first page of the run
+ *
+ * Returns a pointer to the new run if successful, -ENOMEM if not enough memory
+ * is available for enlarging the array
+ */
+
+struct buffer_extent* session_new_buffer_extent(struct session* session,struct page* first_page,void* address){
+
+        /*
+         * Pointer to the new run
+         */
+
+        struct buffer_extent* extent;
+
+        /*
+         * Enlarged array of runs
+         */
+
+        struct buffer_extent* extents;
+
+        /*
+         * New capacity of the array
+         */
+
+        unsigned long max_extents;
+
+        /*
+         * Enlarge the array if it's full
+         */
+
+        if(session->nr_extents==session->max_extents){
+                max_extents=session->max_extents ? 2*session->max_extents : 4;
+                extents=krealloc(session->extents,max_extents*sizeof(struct buffer_extent),GFP_KERNEL);
+                if(!extents)
+                        return ERR_PTR(-ENOMEM);
+                session->extents=extents;
+                session->max_extents=max_extents;
+        }
+
+        /*
+         * Initialize the fields of the run, which starts right after the last page
+         * of the buffer
+         */
+
+        extent=&session->extents[session->nr_extents++];
+        extent->first_page=first_page;
+        extent->address=address;
+        extent->index=session->nr_pages;
+        extent->nr_pages=0;
+        extent->last_access=jiffies;
+        extent->compressed=NULL;
+        extent->compressed_len=0;
+        extent->compressed_dirty=false;
+        extent->hole=false;
+        extent->shadowed=0;
+        return extent;
+}
+
+/*
+ * NEW BUFFER EXTENT - end
+ */
+
+/*
+ * FIND BUFFER EXTENT - start
+ *
+ * Find the run of pages of the session buffer containing a given page, with
+ * a binary search on the array of runs, which are sorted by index
+ *
+ * @session: pointer to the object representing the current session
+ * @index: index of the page within the buffer
+ *
+ * Returns a pointer to the run containing the page, NULL if the page is past
+ * the end of the buffer
+ */
+
+struct buffer_extent* session_find_buffer_extent(struct session* session,pgoff_t index){
+
+        /*
+         * Bounds of the portion of the array still to be searched
+         */
+
+        unsigned long low;
+        unsigned long high;
+
+        /*
+         * Element of the array in the middle of the portion still to be searched
+         */
+
+        unsigned long middle;
+
+        low=0;
+        high=session->nr_extents;
+        while(low<high){
+                middle=low+(high-low)/2;
+                if(index<session->extents[middle].index)
+                        high=middle;
+                else if(index>=session->extents[middle].index+session->extents[middle].nr_pages)
+                        low=middle+1;
+                else
+                        return &session->extents[middle];
+        }
+        return NULL;
+}
+
+/*
+ * FIND BUFFER EXTENT - end
+ */
+
+/*
+ * FILL SESSION PAGE - start
+ *
+ * Copy a page of the opened file into a page of the session buffer using the
+ * function "readpage", from the address_space of the file, to transfer data
+ * from the device where the file is stored to the page frame
+ *
+ * @page: pointer to the descriptor of the page of the buffer to be filled
+ * @index: offset of the page with respect to the beginning of the file (in terms
+ * of pages)
+ * @opened_file: file structure associated to opened file
+ *
+ * Returns 0 if the page is copied, an error code otherwise
+ */
+
+int session_fill_page(struct page* page,pgoff_t index,struct file *opened_file){
+
+        /*
+         * This structure contains pointers to the functions used by the VFS layer
+         * in order to ask the I/O block layer to transfer data to and from devices
+         */
+
+        struct address_space *mapping;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        /*
+         * Get the address_space structure of the opened file
+         */
+
+        mapping = opened_file->f_mapping;
+
+        /*
+         * Lock the page before accessing it
+         */
+
+        __set_page_locked(page);
+
+        /*
+         * Initialize the address_space structure of the new
+         * page to the one of the opened file; also set its
+         * index field, which represents the offset of the page
+         * with respect to the beginning of the file (in terms
+         * of pages)
+         */
+
+        page->mapping = mapping;
+        page->index = index;
+
+        /*
+         * Copy the content of the file to the page using the readpage: this
+         * is a low-level function which wraps the function provided by the
+         * filesystem to read the content of its files into memory
+         *
+         * This function creates an instance of the "struct bio" which
+         * represents an I/O request to a block device (like an hard disk)
+         * and submits this request to the controller of the device
+         *
+         * The function returns 0 when the request is successfully submitted:
+         * if this it not the case, we return the error code, although this
+         * should be unlikely.
+         */
+
+        ret = mapping->a_ops->readpage(opened_file, page);
+        if (ret) {
+
+                /*
+                 * Return error
+                 */
+
+                printk(KERN_INFO "SESSION SEMANTICS->Filling buffer page %lu returned error:%d\n",index,ret);
+                return ret;
+        }
+
+        /*
+         * When the I/O request to the device has been successfully completed,
+         * the bit "PG_uptodate" in the flag of the page descriptor is set.
+         * Also, when the I/O request has been completed, the PG_locked bit in
+         * the flag of the page is cleared => in order to be sure that our I/O
+         * has been completed, the process goes to sleep using the value of the
+         * bit as condition => the process is woken up when the page gets unlocked.
+         * We use the function "lock_page_killable" to implement this mechanism
+         */
+
+        if (!PageUptodate(page)) {
+                ret = lock_page_killable(page);
+
+                /*
+                 * When the process is woken up we check the response of the I/O
+                 * request: in case of error return it
+                 */
+
+                if (ret) {
+
+                        /*
+                         * Return error
+                         */
+
+                        printk(KERN_INFO "SESSION SEMANTICS->Filling buffer page %lu returned error:%d\n",index,ret);
+                        return ret;
+                }
+
+                /*
+                 * Unlock the page and wake up other processes waiting to access
+                 * the page (if any)
+                 */
+
+                unlock_page(page);
+
+                /*
+                 * The page is unlocked without being up to date if the I/O
+                 * request failed: return -EIO (I/O error)
+                 */
+
+                if (!PageUptodate(page)) {
+                        printk(KERN_INFO "SESSION SEMANTICS->Filling buffer page %lu returned error:%d\n",index,-EIO);
+                        return -EIO;
+                }
+        }
+
+        /*
+         * The page was copied from the storage of the file without making use of
+         * the buffer cache, so return 0
+         */
+
+        return 0;
+}
+
+/*
+ * FILL SESSION PAGE - end
+ */
+
+/*
+ * HASH SESSION PAGES - start
+ *
+ * Applications often write back a whole file after modifying a few bytes of it,
+ * or rewrite bytes with the same value. To find out which pages of the session
+ * really changed, each page read from the file is hashed as soon as it's filled
+ * (see "session_fill_buffer" and "session_load_page"), and its hash is compared
+ * with the hash of its content when the session is committed (see
+ * "session_flush_changes"). A hash of 64 bits is made of two hashes computed with
+ * different seeds, and a hash of 0 stands for a page that was not hashed, so
+ * such a page always counts as changed
+ */
+
+#define SESSION_HASH_SEED_LOW 0x5e551011
+#define SESSION_HASH_SEED_HIGH 0x9e3779b9
+
+/*
+ * Hash a sequence of bytes
+ *
+ * @data: address of the first byte
+ * @len: number of bytes
+ *
+ * Returns the hash of the bytes
+ */
+
+u64 session_hash(const void *data, size_t len){
+        if (!(len & 3))
+                return (u64) jhash2(data, (u32) (len >> 2), SESSION_HASH_SEED_HIGH) << 32 |
+                        jhash2(data, (u32) (len >> 2), SESSION_HASH_SEED_LOW);
+        return (u64) jhash(data, (u32) len, SESSION_HASH_SEED_HIGH) << 32 |
+                jhash(data, (u32) len, SESSION_HASH_SEED_LOW);
+}
+
+/*
+ * Allocate the array of hashes of the pages holding the original content of the
+ * file, if "session_skip_unchanged" is set; the array of a large file is allocated
+ * with "vmalloc". Without the array, every page written counts as changed
+ *
+ * @session: pointer to the object representing the current session; its field
+ * "snapshot_size" must have already been set
+ */
+
+void session_alloc_hashes(struct session *session){
+
+        /*
+         * Number of bytes of the array
+         */
+
+        size_t size;
+
+        if (!session_skip_unchanged || !session->snapshot_size)
+                return;
+        session->nr_hashes = (unsigned long) ((session->snapshot_size + PAGE_SIZE - 1) >> PAGE_SHIFT);
+        size = session->nr_hashes * sizeof(u64);
+        session->hashes = size > PAGE_SIZE ? vmalloc(size) : kmalloc(size, GFP_KERNEL);
+        if (!session->hashes) {
+                session->nr_hashes = 0;
+                return;
+        }
+        memset(session->hashes, 0, size);
+}
+
+/*
+ * Store the hash of a page of the session buffer just filled with the original
+ * content of the file
+ *
+ * @session: pointer to the object representing the current session
+ * @page: page of the buffer
+ * @index: index of the page within the buffer
+ */
+
+void session_hash_page(struct session *session, struct page *page, pgoff_t index){
+        if (index < session->nr_hashes)
+                session->hashes[index] = session_hash(page_address(page), PAGE_SIZE);
+}
+
+/*
+ * Check if a page of the session buffer still holds the content it was filled
+ * with. Pages never written are unchanged by definition
+ *
+ * @session: pointer to the object representing the current session
+ * @page: page of the buffer, holding valid content
+ * @index: index of the page within the buffer
+ *
+ * Returns true if the content of the page did not change
+ */
+
+bool session_page_unchanged(struct session *session, struct page *page, pgoff_t index){
+        if (!PageDirty(page))
+                return true;
+        return index < session->nr_hashes && session->hashes[index] &&
+                session->hashes[index] == session_hash(page_address(page), PAGE_SIZE);
+}
+
+/*
+ * Release the array of hashes
+ *
+ * @session: pointer to the object representing the current session
+ */
+
+void session_free_hashes(struct session *session){
+        if (is_vmalloc_addr(session->hashes))
+                vfree(session->hashes);
+        else
+                kfree(session->hashes);
+        session->hashes = NULL;
+        session->nr_hashes = 0;
+}
+
+/*
+ * HASH SESSION PAGES - end
+ */
+
+/*
+ * FILL SESSION BUFFER - start
+ *
+ * Copy the content of the opened file into the session buffer, page by page,
+ * scanning the runs of pages of the buffer. For each page, the function
+ * "readpage", from the address_space of the file, is used to
+ * transfer data from the device where the file is stored to the page frame
+ *
+ * Only the pages which are not up to date are filled, i.e. those corresponding
+ * to the original content of the file
+ *
+ * @session: pointer to the object representing the current session
+ * @opened_file: file structure associated to opened file
+ *
+ * Returns 0 if the whole file is copied, an error code otherwise
+ */
+
+int session_fill_buffer(struct session *session,struct file *opened_file){
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        /*
+         * Run of pages of the buffer used to iterate through the session buffer
+         */
+
+        struct buffer_extent* extent;
+
+        /*
+         * Index of a page within the current run
+         */
+
+        unsigned long i;
+
+        /*
+         * Copy the content of the opened file into the session buffer, page by page
+         */
+
+        for (extent = session->extents; extent < session->extents + session->nr_extents; extent++) {
+                if (extent->hole)
+                        continue;
+                for (i = 0; i < extent->nr_pages; i++) {
+                        if (PageUptodate(extent->first_page + i))
+                                continue;
+                        ret = session_fill_page(extent->first_page + i, extent->index + i, opened_file);
+                        if (ret) {
+                                printk(KERN_INFO "SESSION SEMANTICS->Filling buffer returned error:%d\n",ret);
+                                return ret;
+                        }
+                        session_hash_page(session, extent->first_page + i, extent->index + i);
+                }
+        }
+
+        /*
+         * The content of the file was fully copied from its storage into the session
+         * without making use of the buffer, so return 0
+         */
+
+        printk(KERN_INFO "SESSION SEMANTICS->Filling buffer was successfull\n");
+        return 0;
+}
+
+/*
+ * FILL SESSION BUFFER - end
+ */
+
+/*
+ * LOAD SESSION PAGE - start
+ *
+ * Make sure that a page of the session buffer holds the content of the original
+ * file before it is accessed. Pages of the buffer that were not filled when the
+ * session was opened (see "session_open") have the PG_uptodate bit cleared and
+ * they are filled here the first time they are needed: in case the whole page is
+ * going to be overwritten, its original content is useless and it's not loaded.
+ * If the original file was modified since the session was opened, its original
+ * content is lost and the page can't be loaded anymore
+ *
+ * @session: pointer to the object representing the current session
+ * @page: pointer to the descriptor of the page of the buffer to be accessed
+ * @index: index of the page within the buffer
+ * @overwrite: true if the whole page is going to be overwritten
+ *
+ * Returns 0 if the page can be accessed, -ESTALE if the original file was modified,
+ * or the error code returned while reading the page
+ */
+
+int session_load_page(struct session *session, struct page *page, pgoff_t index, bool overwrite){
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        /*
+         * Nothing to do if the page already holds valid content
+         */
+
+        if (PageUptodate(page))
+                return 0;
+
+        /*
+         * If the page is fully overwritten, its original content does not need to
+         * be read from the device
+         */
+
+        if (overwrite) {
+                SetPageUptodate(page);
+                return 0;
+        }
+        printk(KERN_INFO "SESSION SEMANTICS->Loading buffer page %lu on demand\n",index);
+        ret = session_fill_page(page, index, session->file);
+        if (ret)
+                return ret;
+
+        /*
+         * The page must hold the content the file had when the session was opened:
+         * if the file was modified in the meantime, the page is left unloaded and
+         * -ESTALE is returned, as for the runs released by the shrinker (see
+         * "session_reload_extent")
+         */
+
+        if (!session_snapshot_valid(session)) {
+                ClearPageUptodate(page);
+                printk(KERN_INFO "SESSION SEMANTICS->File %s was modified, page %lu can't be loaded\n",session->filename,index);
+                return -ESTALE;
+        }
+        session_hash_page(session, page, index);
+        return 0;
+}
+
+/*
+ * LOAD SESSION PAGE - end
+ */
+
+/*
+ * RELEASE BUFFER EXTENT - start
+ *
+ * Give the pages of a run of the session buffer back to the system, leaving the
+ * run in its place within the buffer without any page; the caller keeps track of
+ * the reason why the run was released
+ *
+ * @extent: run of pages to be released
+ */
+
+void session_release_extent(struct buffer_extent *extent){
+
+        /*
+         * Index to iterate through the pages of the run
+         */
+
+        unsigned long i;
+
+        for (i = 0; i < extent->nr_pages; i++) {
+                extent->first_page[i].mapping = NULL;
+                atomic_long_dec(&session_node_pages[page_to_nid(extent->first_page + i)]);
+        }
+        session_uncharge_pages(extent->first_page, extent->nr_pages);
+        for (i = 0; i < extent->nr_pages; i++)
+                __free_page(extent->first_page + i);
+        extent->first_page = NULL;
+        extent->address = NULL;
+}
+
+/*
+ * RELEASE BUFFER EXTENT - end
+ */
+
+/*
+ * COMPRESS SESSION PAGES - start
+ *
+ * Long-running sessions often keep large files which are rarely accessed after
+ * the session is opened. If "session_compress_secs" is set, a background work
+ * periodically looks for runs of pages not accessed for that number of seconds,
+ * compresses their content with LZO and releases their pages. A compressed run
+ * keeps its position in the buffer, and its content is decompressed into new
+ * pages as soon as it's accessed (see "session_reload_extent"), be it by a read,
+ * a write or the commit of the session.
+ *
+ * A run is kept compressed only if this saves at least one eighth of its size
+ */
+
+/*
+ * Compression algorithm of the crypto API used for the session pages, NULL if it
+ * is not available
+ */
+
+struct crypto_comp *session_tfm;
+
+/*
+ * Mutex serializing the use of the compression algorithm
+ */
+
+DEFINE_MUTEX(session_compress_mutex);
+
+/*
+ * Buffer the largest run of pages is compressed into, before its compressed
+ * content is copied into an object of the right size; allocated the first time
+ * compression is enabled
+ */
+
+void *session_compress_scratch;
+
+/*
+ * Size of the buffer above, enough for the worst case of LZO
+ */
+
+#define SESSION_COMPRESS_SCRATCH lzo1x_worst_compress(PAGE_SIZE << SESSION_HUGE_ORDER)
+
+/*
+ * Background work compressing the idle runs of pages
+ */
+
+struct delayed_work session_compress_work;
+
+/*
+ * Decompress the content of a compressed run into a buffer, then release the
+ * compressed content; the caller restores the state of the pages of the run
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ * @extent: run of pages to be decompressed
+ * @dst: buffer of "extent->nr_pages" pages the content is decompressed into
+ *
+ * Returns 0 if successful, -EIO if the content can't be decompressed, in which
+ * case the run stays compressed
+ */
+
+int session_decompress_extent(struct session *session, struct buffer_extent *extent, void *dst){
+
+        /*
+         * Number of bytes of the run, and number of bytes decompressed
+         */
+
+        unsigned int bytes;
+        unsigned int len;
+
+        /*
+         * Time the decompression started
+         */
+
+        ktime_t start;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        bytes = extent->nr_pages << PAGE_SHIFT;
+        len = bytes;
+        start = ktime_get();
+        mutex_lock(&session_compress_mutex);
+        ret = crypto_comp_decompress(session_tfm, extent->compressed, extent->compressed_len, dst, &len);
+        mutex_unlock(&session_compress_mutex);
+        if (ret || len != bytes) {
+                printk(KERN_INFO "SESSION SEMANTICS->Pages %lu-%lu can't be decompressed\n",
+                       extent->index, extent->index + extent->nr_pages - 1);
+                return -EIO;
+        }
+        atomic_long_inc(&session_decompressions);
+        atomic64_add(ktime_to_ns(ktime_sub(ktime_get(), start)), &session_decompress_ns);
+        atomic_long_sub(bytes, &session_compressed_bytes);
+        atomic_long_sub(extent->compressed_len, &session_compressed_size);
+        vfree(extent->compressed);
+        extent->compressed = NULL;
+        extent->compressed_len = 0;
+        session->nr_compressed -= extent->nr_pages;
+        return 0;
+}
+
+/*
+ * Compress a run of pages if it was not accessed for the given time, then
+ * release its pages
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ * @extent: run of pages to be compressed
+ * @idle: number of jiffies since the last access after which the run is compressed
+ *
+ * Returns the number of pages released
+ */
+
+unsigned long session_compress_extent(struct session *session, struct buffer_extent *extent, unsigned long idle){
+
+        /*
+         * Number of bytes of the run, and number of bytes of its compressed content
+         */
+
+        unsigned int bytes;
+        unsigned int len;
+
+        /*
+         * Compressed content of the run
+         */
+
+        void *compressed;
+
+        /*
+         * True if some pages of the run were written
+         */
+
+        bool dirty;
+
+        /*
+         * Index to iterate through the pages of the run
+         */
+
+        unsigned long i;
+
+        /*
+         * Only runs with pages, all holding valid content, can be compressed
+         */
+
+        if (!extent->first_page || time_before(jiffies, extent->last_access + idle))
+                return 0;
+        dirty = false;
+        for (i = 0; i < extent->nr_pages; i++) {
+                if (!PageUptodate(extent->first_page + i))
+                        return 0;
+                if (PageDirty(extent->first_page + i))
+                        dirty = true;
+        }
+
+        /*
+         * Compress the run and keep the result only if it's small enough; otherwise
+         * don't try again until the run has been idle for a while longer
+         */
+
+        bytes = extent->nr_pages << PAGE_SHIFT;
+        len = SESSION_COMPRESS_SCRATCH;
+        compressed = NULL;
+        mutex_lock(&session_compress_mutex);
+        if (!crypto_comp_compress(session_tfm, extent->address, bytes, session_compress_scratch, &len) &&
+            len <= bytes - bytes / 8) {
+                compressed = vmalloc(len);
+                if (compressed)
+                        memcpy(compressed, session_compress_scratch, len);
+        }
+        mutex_unlock(&session_compress_mutex);
+        if (!compressed) {
+                extent->last_access = jiffies;
+                return 0;
+        }
+
+        /*
+         * Replace the pages of the run with its compressed content
+         */
+
+        session_release_extent(extent);
+        extent->compressed = compressed;
+        extent->compressed_len = len;
+        extent->compressed_dirty = dirty;
+        session->nr_compressed += extent->nr_pages;
+        atomic_long_add(bytes, &session_compressed_bytes);
+        atomic_long_add(len, &session_compressed_size);
+        return extent->nr_pages;
+}
+
+/*
+ * Scan the sessions and compress their idle runs of pages, then schedule the next
+ * scan. Sessions in use, whose mutex is held, are skipped. A session is not removed
+ * from the list while its mutex is held (see "session_remove"), so the list is
+ * unlocked while the runs of the session are compressed
+ *
+ * @work: unused
+ */
+
+void session_compress_scan(struct work_struct *work){
+
+        /*
+         * Session used in the iteration, and the one following it
+         */
+
+        struct session *session;
+        struct session *next;
+
+        /*
+         * Run of pages used in the iteration
+         */
+
+        struct buffer_extent *extent;
+
+        /*
+         * Number of pages released
+         */
+
+        unsigned long compressed;
+
+        /*
+         * Interval of the scans, in seconds
+         */
+
+        int secs;
+
+        secs = session_compress_secs;
+        compressed = 0;
+        if (secs > 0 && session_tfm && !session_compress_scratch)
+                session_compress_scratch = vmalloc(SESSION_COMPRESS_SCRATCH);
+        if (secs > 0 && session_tfm && session_compress_scratch) {
+                spin_lock(&sessions_list->lock);
+                session = list_first_entry(&sessions_list->sessions_head, struct session, link_to_list);
+                while (&session->link_to_list != &sessions_list->sessions_head) {
+                        if (!mutex_trylock(&session->mutex)) {
+                                session = list_entry(session->link_to_list.next, struct session, link_to_list);
+                                continue;
+                        }
+                        spin_unlock(&sessions_list->lock);
+                        for (extent = session->extents; extent < session->extents + session->nr_extents; extent++)
+                                compressed += session_compress_extent(session, extent, (unsigned long) secs * HZ);
+                        spin_lock(&sessions_list->lock);
+                        next = list_entry(session->link_to_list.next, struct session, link_to_list);
+                        mutex_unlock(&session->mutex);
+                        session = next;
+                }
+                spin_unlock(&sessions_list->lock);
+        }
+        if (compressed)
+                printk(KERN_INFO "SESSION SEMANTICS->Compressed %lu idle session pages\n", compressed);
+
+        /*
+         * While compression is disabled, check every 10 seconds if it was enabled
+         */
+
+        schedule_delayed_work(&session_compress_work, (secs > 0 ? secs : 10) * HZ);
+}
+
+/*
+ * Set up the compression algorithm and start the scans of the sessions; if LZO is
+ * not available, pages are never compressed
+ */
+
+void session_compress_init(void){
+        session_tfm = crypto_alloc_comp("lzo", 0, 0);
+        if (IS_ERR(session_tfm)) {
+                printk(KERN_INFO "SESSION SEMANTICS->LZO not available: session pages won't be compressed\n");
+                session_tfm = NULL;
+        }
+        INIT_DELAYED_WORK(&session_compress_work, session_compress_scan);
+        schedule_delayed_work(&session_compress_work, 10 * HZ);
+}
+
+/*
+ * Stop the scans of the sessions and release the compression algorithm. The
+ * compressed runs of the sessions still open are released with the sessions
+ */
+
+void session_compress_remove(void){
+        cancel_delayed_work_sync(&session_compress_work);
+        vfree(session_compress_scratch);
+        if (session_tfm)
+                crypto_free_comp(session_tfm);
+}
+
+/*
+ * COMPRESS SESSION PAGES - end
+ */
+
+/*
+ * RECLAIM SESSION PAGES - start
+ *
+ * The pages of a session which were never written hold the content of the file
+ * as it was when the session was opened. As long as the file is not modified,
+ * they can be released under memory pressure and read again from the file when
+ * they are accessed, so that idle read-mostly sessions don't hoard memory. A
+ * shrinker releases whole runs of pages whose pages are all clean (i.e. they
+ * don't have the PG_dirty bit set, see "session_copy_buffer"); a released run
+ * keeps its position in the buffer, but it has no pages until it's reloaded.
+ *
+ * The file is considered unmodified if its size, modification time and version
+ * are the same as when the session was opened. The version of the inode is kept
+ * up to date only by filesystems mounted with MS_I_VERSION, and the modification
+ * time may be as coarse as one second, so on the other filesystems the file is
+ * always considered modified
+ */
+
+/*
+ * Check if the original file is still the same as when the session was opened
+ *
+ * @session: pointer to the object representing the current session
+ *
+ * Returns true if the file was not modified
+ */
+
+bool session_snapshot_valid(struct session *session){
+
+        /*
+         * Inode of the original file
+         */
+
+        struct inode *inode;
+
+        inode = session->file->f_dentry->d_inode;
+        return IS_I_VERSION(inode) && i_size_read(inode) == session->snapshot_size &&
+                timespec_equal(&inode->i_mtime, &session->snapshot_mtime) &&
+                inode->i_version == session->snapshot_version;
+}
+
+/*
+ * Give new pages to a run of the buffer released by the shrinker, and read their
+ * content from the original file again; if the run was released because it was
+ * compressed, its content is decompressed instead. The pages are allocated as a
+ * single block if possible; otherwise, since memory is short, the run is given
+ * smaller blocks, down to single pages, and it's replaced by a run for each block.
+ * The array of runs may be moved, so pointers to its elements must be looked up
+ * again (see "session_find_buffer_extent")
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ * @extentp: run of pages to be reloaded, set to the first of the runs replacing it
+ *
+ * Returns 0 if the run is reloaded (or it was never released, or it's a hole), -ESTALE if the
+ * original file was modified in the meantime, -ENOMEM if not enough memory is
+ * available, -EIO if the content of the run can't be decompressed, or the error
+ * code returned while reading the file. The run is left as it was if no page
+ * could be given to it or its content can't be decompressed
+ */
+
+int session_reload_extent(struct session *session, struct buffer_extent **extentp){
+
+        /*
+         * Run being reloaded, a copy of it, and run used to iterate through the
+         * runs replacing it
+         */
+
+        struct buffer_extent *extent;
+        struct buffer_extent released;
+        struct buffer_extent *run;
+
+        /*
+         * Blocks of pages allocated for the run, linked through the descriptors of
+         * their first pages, which keep the number of pages of the block in their
+         * private field until the block is given to the run
+         */
+
+        LIST_HEAD(blocks);
+        struct page *first;
+        struct page *next;
+        unsigned long nr_blocks;
+
+        /*
+         * Order of the next block to be allocated, and number of pages of the run
+         * covered by the blocks allocated
+         */
+
+        unsigned int order;
+        unsigned long covered;
+        unsigned long nr_pages;
+
+        /*
+         * Enlarged array of runs, its new capacity, and position of the run within
+         * the array
+         */
+
+        struct buffer_extent *extents;
+        unsigned long max_extents;
+        unsigned long pos;
+
+        /*
+         * Buffer the content of a compressed run is decompressed into, when it's
+         * given several blocks
+         */
+
+        void *content;
+
+        /*
+         * True if the run was compressed
+         */
+
+        bool compressed;
+
+        /*
+         * Index to iterate through the pages of a block
+         */
+
+        unsigned long i;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        extent = *extentp;
+        if (extent->first_page || extent->hole)
+                return 0;
+        if (!extent->compressed && !session_snapshot_valid(session)) {
+                printk(KERN_INFO "SESSION SEMANTICS->Pages %lu-%lu can't be reloaded: file was modified\n",
+                       extent->index, extent->index + extent->nr_pages - 1);
+                return -ESTALE;
+        }
+
+        /*
+         * Allocate blocks covering the run, as large as possible, and release the
+         * pages in excess
+         */
+
+        nr_blocks = 0;
+        covered = 0;
+        order = 0;
+        while ((1UL << order) < extent->nr_pages)
+                order++;
+        ret = 0;
+        while (covered < extent->nr_pages) {
+                while (order && (1UL << (order - 1)) >= extent->nr_pages - covered)
+                        order--;
+                first = alloc_pages_node(session->node, order ? GFP_KERNEL | __GFP_NOWARN | __GFP_NORETRY : GFP_KERNEL, order);
+                if (!first && order) {
+                        order--;
+                        continue;
+                }
+                if (!first) {
+                        ret = -ENOMEM;
+                        break;
+                }
+                nr_pages = min_t(unsigned long, 1UL << order, extent->nr_pages - covered);
+                split_page(first, order);
+                for (i = nr_pages; i < (1UL << order); i++)
+                        __free_page(first + i);
+                ret = session_charge_pages(first, nr_pages);
+                if (ret) {
+                        for (i = 0; i < nr_pages; i++)
+                                __free_page(first + i);
+                        break;
+                }
+                set_page_private(first, nr_pages);
+                list_add_tail(&first->lru, &blocks);
+                nr_blocks++;
+                covered += nr_pages;
+        }
+
+        /*
+         * Make room in the array for the runs replacing the run, then decompress
+         * the content of a compressed run, straight into its block if it has only
+         * one
+         */
+
+        pos = extent - session->extents;
+        if (!ret && session->nr_extents + nr_blocks - 1 > session->max_extents) {
+                max_extents = max(2 * session->max_extents, session->nr_extents + nr_blocks - 1);
+                extents = krealloc(session->extents, max_extents * sizeof(struct buffer_extent), GFP_KERNEL);
+                if (extents) {
+                        session->extents = extents;
+                        session->max_extents = max_extents;
+                }
+                else
+                        ret = -ENOMEM;
+        }
+        extent = &session->extents[pos];
+        released = *extent;
+        compressed = released.compressed != NULL;
+        content = NULL;
+        if (!ret && compressed) {
+                if (nr_blocks == 1)
+                        ret = session_decompress_extent(session, &released, page_address(list_first_entry(&blocks, struct page, lru)));
+                else {
+                        content = vmalloc(released.nr_pages << PAGE_SHIFT);
+                        ret = content ? session_decompress_extent(session, &released, content) : -ENOMEM;
+                }
+        }
+        if (ret) {
+                list_for_each_entry_safe(first, next, &blocks, lru) {
+                        list_del(&first->lru);
+                        nr_pages = page_private(first);
+                        set_page_private(first, 0);
+                        session_uncharge_pages(first, nr_pages);
+                        for (i = 0; i < nr_pages; i++)
+                                __free_page(first + i);
+                }
+                vfree(content);
+                *extentp = extent;
+                return ret;
+        }
+
+        /*
+         * Replace the run with a run for each block; the pages of a compressed run
+         * hold its content again, so restore their state
+         */
+
+        memmove(&session->extents[pos + nr_blocks], &session->extents[pos + 1],
+                (session->nr_extents - pos - 1) * sizeof(struct buffer_extent));
+        session->nr_extents += nr_blocks - 1;
+        run = &session->extents[pos];
+        covered = 0;
+        list_for_each_entry_safe(first, next, &blocks, lru) {
+                list_del(&first->lru);
+                nr_pages = page_private(first);
+                set_page_private(first, 0);
+                *run = released;
+                run->first_page = first;
+                run->address = kmap(first);
+                run->index = released.index + covered;
+                run->nr_pages = nr_pages;
+                run->last_access = jiffies;
+                run->compressed_dirty = false;
+                run->shadowed = released.shadowed > covered ? min(released.shadowed - covered, nr_pages) : 0;
+                if (content)
+                        memcpy(run->address, content + (covered << PAGE_SHIFT), nr_pages << PAGE_SHIFT);
+                for (i = 0; i < nr_pages; i++) {
+                        atomic_long_inc(&session_node_pages[page_to_nid(first + i)]);
+                        if (compressed)
+                                SetPageUptodate(first + i);
+                        if (compressed && released.compressed_dirty)
+                                SetPageDirty(first + i);
+                }
+                covered += nr_pages;
+                run++;
+        }
+        vfree(content);
+        *extentp = &session->extents[pos];
+        if (compressed)
+                return 0;
+        session->nr_evicted -= released.nr_pages;
+
+        /*
+         * Read the content of the run again, then make sure that the file did not
+         * change while it was read
+         */
+
+        printk(KERN_INFO "SESSION SEMANTICS->Reloading pages %lu-%lu in %lu blocks\n",
+               released.index, released.index + released.nr_pages - 1, nr_blocks);
+        for (run = &session->extents[pos]; run < &session->extents[pos + nr_blocks]; run++)
+                for (i = 0; i < run->nr_pages; i++) {
+                        ret = session_fill_page(run->first_page + i, run->index + i, session->file);
+                        if (ret)
+                                return ret;
+                        session_hash_page(session, run->first_page + i, run->index + i);
+                }
+        if (!session_snapshot_valid(session))
+                return -ESTALE;
+        return 0;
+}
+
+/*
+ * Release the runs of clean pages of a session, up to "nr_to_scan" pages
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ * @nr_to_scan: number of pages to be released
+ *
+ * Returns the number of pages released
+ */
+
+unsigned long session_evict_extents(struct session *session, unsigned long nr_to_scan){
+
+        /*
+         * Run of pages used in the iteration
+         */
+
+        struct buffer_extent *extent;
+
+        /*
+         * Number of pages of the buffer holding the content of the file when the
+         * session was opened
+         */
+
+        unsigned long snapshot_pages;
+
+        /*
+         * Number of pages released
+         */
+
+        unsigned long evicted;
+
+        /*
+         * Index to iterate through the pages of a run
+         */
+
+        unsigned long i;
+
+        if (session->inline_data || !session->clean_size || !session_snapshot_valid(session))
+                return 0;
+        snapshot_pages = (unsigned long) ((session->clean_size + PAGE_SIZE - 1) >> PAGE_SHIFT);
+        evicted = 0;
+        for (extent = session->extents; extent < session->extents + session->nr_extents && evicted < nr_to_scan; extent++) {
+
+                /*
+                 * Only runs made of clean pages holding the original content of the
+                 * file can be released
+                 */
+
+                if (!extent->first_page || extent->index + extent->nr_pages > snapshot_pages)
+                        continue;
+                for (i = 0; i < extent->nr_pages; i++)
+                        if (PageDirty(extent->first_page + i))
+                                break;
+                if (i < extent->nr_pages)
+                        continue;
+
+                /*
+                 * Release the pages of the run
+                 */
+
+                session_release_extent(extent);
+                session->nr_evicted += extent->nr_pages;
+                evicted += extent->nr_pages;
+        }
+        return evicted;
+}
+
+/*
+ * Shrinker of the session buffers: when asked for it, release the requested number
+ * of clean pages, then report how many pages could still be released. Sessions in
+ * use, whose mutex is held, are skipped
+ *
+ * @nr_to_scan: number of pages to be released, 0 to just get the number of pages
+ * that could be released
+ * @gfp_mask: allocation flags of the caller
+ *
+ * Returns the number of pages of the sessions that could be released
+ */
+
+int session_reclaim_shrink(int nr_to_scan, gfp_t gfp_mask){
+
+        /*
+         * Session used in the iteration
+         */
+
+        struct session *session;
+
+        /*
+         * Number of pages released
+         */
+
+        unsigned long evicted;
+
+        /*
+         * Number of pages that could still be released
+         */
+
+        unsigned long resident;
+
+        evicted = 0;
+        resident = 0;
+        spin_lock(&sessions_list->lock);
+        list_for_each_entry(session, &sessions_list->sessions_head, link_to_list) {
+                if (!session->snapshot_size)
+                        continue;
+                if (nr_to_scan > 0 && evicted < (unsigned long) nr_to_scan && mutex_trylock(&session->mutex)) {
+                        evicted += session_evict_extents(session, (unsigned long) nr_to_scan - evicted);
+                        mutex_unlock(&session->mutex);
+                }
+                resident += session->nr_pages - session->nr_evicted - session->nr_compressed - session->nr_holes;
+        }
+        spin_unlock(&sessions_list->lock);
+        if (evicted)
+                printk(KERN_INFO "SESSION SEMANTICS->Shrinker released %lu clean session pages\n", evicted);
+        return (int) min_t(unsigned long, resident, INT_MAX);
+}
+
+struct shrinker session_reclaim_shrinker = {
+        .shrink = session_reclaim_shrink,
+        .seeks = DEFAULT_SEEKS,
+};
+
+/*
+ * Register the shrinker of the session buffers
+ */
+
+void session_reclaim_init(void){
+        register_shrinker(&session_reclaim_shrinker);
+}
+
+/*
+ * Unregister the shrinker of the session buffers
+ */
+
+void session_reclaim_remove(void){
+        unregister_shrinker(&session_reclaim_shrinker);
+}
+
+/*
+ * RECLAIM SESSION PAGES - end
+ */
+
+/*
+ * SPARSE SESSION BUFFER - start
+ *
+ * A session may have holes, i.e. ranges of pages full of zeros: the holes of a
+ * sparse file opened in session, and the ranges skipped by a write past the end
+ * of the file. A hole is a run of the buffer (see "struct buffer_extent") with no
+ * page at all: reading it returns zeros, and its pages are allocated only when
+ * they are written. Holes are left as holes in the original file when the session
+ * is committed, since the file is truncated before the content of the session is
+ * written back into it
+ */
+
+/*
+ * Append a hole of "nr_pages" pages to the session buffer, merging it with the
+ * last run of the buffer if that's a hole too
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ * @nr_pages: number of pages of the hole
+ *
+ * Returns 0 if successful, -ENOMEM if not enough memory is available
+ */
+
+int session_new_hole(struct session *session, unsigned long nr_pages){
+
+        /*
+         * Run of the buffer the hole is added to
+         */
+
+        struct buffer_extent *extent;
+
+        extent = session->nr_extents ? &session->extents[session->nr_extents - 1] : NULL;
+        if (!extent || !extent->hole) {
+                extent = session_new_buffer_extent(session, NULL, NULL);
+                if (IS_ERR(extent))
+                        return PTR_ERR(extent);
+                extent->hole = true;
+        }
+        extent->nr_pages += nr_pages;
+        session->nr_pages += nr_pages;
+        session->nr_holes += nr_pages;
+        return 0;
+}
+
+/*
+ * Give zeroed pages to a portion of a hole which is going to be written. The pages
+ * from "from" to "to" are turned into a run of pages of their own (at most a block
+ * of order SESSION_HUGE_ORDER), and the rest of the hole is left before and after
+ * it. The array of runs may be moved, so pointers to its elements must be looked
+ * up again (see "session_find_buffer_extent")
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ * @extent: hole containing the pages
+ * @from: index of the first page to be allocated
+ * @to: index of the last page to be allocated
+ *
+ * Returns 0 if successful, -ENOMEM if not enough memory is available
+ */
+
+int session_fill_hole(struct session *session, struct buffer_extent *extent, pgoff_t from, pgoff_t to){
+
+        /*
+         * The hole being split, and the run of pages used to iterate through the
+         * runs replacing it
+         */
+
+        struct buffer_extent hole;
+        struct buffer_extent *run;
+
+        /*
+         * Enlarged array of runs, and its new capacity
+         */
+
+        struct buffer_extent *extents;
+        unsigned long max_extents;
+
+        /*
+         * Position of the hole within the array of runs
+         */
+
+        unsigned long pos;
+
+        /*
+         * Number of pages allocated, and number of pages of the hole left before
+         * and after them
+         */
+
+        unsigned long nr_pages;
+        unsigned long before;
+        unsigned long after;
+
+        /*
+         * Number of runs replacing the hole
+         */
+
+        unsigned long nr_runs;
+
+        /*
+         * Order of the block of pages allocated
+         */
+
+        unsigned int order;
+
+        /*
+         * Pointer to the descriptor of the first page of the block
+         */
+
+        struct page *first;
+
+        /*
+         * Index to iterate through the pages of the block
+         */
+
+        unsigned long i;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        /*
+         * Make room in the array for the two runs that may be added
+         */
+
+        pos = extent - session->extents;
+        if (session->nr_extents + 2 > session->max_extents) {
+                max_extents = max(2 * session->max_extents, session->nr_extents + 2);
+                extents = krealloc(session->extents, max_extents * sizeof(struct buffer_extent), GFP_KERNEL);
+                if (!extents)
+                        return -ENOMEM;
+                session->extents = extents;
+                session->max_extents = max_extents;
+        }
+
+        /*
+         * Allocate a block covering the pages, or a smaller one if no such block is
+         * readily available, and release the pages in excess
+         */
+
+        to = min_t(pgoff_t, to, session->extents[pos].index + session->extents[pos].nr_pages - 1);
+        nr_pages = min_t(unsigned long, to - from + 1, 1UL << SESSION_HUGE_ORDER);
+        order = 0;
+        while ((1UL << order) < nr_pages)
+                order++;
+        for (;;) {
+                first = alloc_pages_node(session->node, order ? GFP_KERNEL | __GFP_NOWARN | __GFP_NORETRY : GFP_KERNEL, order);
+                if (first || !order)
+                        break;
+                order--;
+                nr_pages = 1UL << order;
+        }
+        if (!first)
+                return -ENOMEM;
+        split_page(first, order);
+        for (i = nr_pages; i < (1UL << order); i++)
+                __free_page(first + i);
+        ret = session_charge_pages(first, nr_pages);
+        if (ret) {
+                for (i = 0; i < nr_pages; i++)
+                        __free_page(first + i);
+                return ret;
+        }
+        for (i = 0; i < nr_pages; i++) {
+                clear_highpage(first + i);
+                SetPageUptodate(first + i);
+                atomic_long_inc(&session_node_pages[page_to_nid(first + i)]);
+        }
+
+        /*
+         * Replace the hole with the part of the hole before the pages, if any, the
+         * run of pages and the part of the hole after the pages, if any
+         */
+
+        hole = session->extents[pos];
+        before = from - hole.index;
+        after = hole.nr_pages - before - nr_pages;
+        nr_runs = 1 + (before ? 1 : 0) + (after ? 1 : 0);
+        memmove(&session->extents[pos + nr_runs], &session->extents[pos + 1],
+                (session->nr_extents - pos - 1) * sizeof(struct buffer_extent));
+        session->nr_extents += nr_runs - 1;
+        run = &session->extents[pos];
+        if (before) {
+                run->nr_pages = before;
+                run++;
+        }
+        run->first_page = first;
+        run->address = kmap(first);
+        run->index = from;
+        run->nr_pages = nr_pages;
+        run->last_access = jiffies;
+        run->compressed = NULL;
+        run->compressed_len = 0;
+        run->compressed_dirty = false;
+        run->hole = false;
+        run->shadowed = 0;
+        if (after) {
+                run++;
+                *run = hole;
+                run->index = from + nr_pages;
+                run->nr_pages = after;
+        }
+        session->nr_holes -= nr_pages;
+        printk(KERN_INFO "SESSION SEMANTICS->Allocated pages %lu-%lu of a hole\n", from, from + nr_pages - 1);
+        return 0;
+}
+
+/*
+ * Fill a range of the session buffer with zeros, leaving its holes alone. Used
+ * when a write past the end of the session leaves a gap behind it
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ * @pos: offset of the first byte to be cleared, relative to the first byte stored
+ * in the session buffer
+ * @size: number of bytes to be cleared
+ *
+ * Returns 0 if successful, or the error code returned while loading a page
+ */
+
+int session_clear_buffer(struct session *session, loff_t pos, loff_t size){
+
+        /*
+         * Run of pages of the buffer used in the iteration
+         */
+
+        struct buffer_extent *extent;
+
+        /*
+         * Index of a page of the range
+         */
+
+        pgoff_t index;
+
+        /*
+         * Offset of the first byte of the page, and number of bytes cleared at
+         * each iteration
+         */
+
+        loff_t page_start;
+        loff_t bytes;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        while (size > 0) {
+                index = (pgoff_t) (pos >> PAGE_SHIFT);
+                page_start = (loff_t) index << PAGE_SHIFT;
+                extent = session_find_buffer_extent(session, index);
+                if (!extent)
+                        return -EIO;
+
+                /*
+                 * Holes are skipped as a whole, the other runs are cleared one page
+                 * at a time
+                 */
+
+                if (extent->hole)
+                        bytes = min_t(loff_t, size, ((loff_t) (extent->index + extent->nr_pages) << PAGE_SHIFT) - pos);
+                else {
+                        bytes = min_t(loff_t, size, page_start + PAGE_SIZE - pos);
+                        ret = session_reload_extent(session, &extent);
+                        if (!ret) {
+                                extent = session_find_buffer_extent(session, index);
+                                ret = session_load_page(session, extent->first_page + (index - extent->index), index,
+                                                        bytes == PAGE_SIZE);
+                        }
+                        if (ret)
+                                return ret;
+                        memset(extent->address + (pos - ((loff_t) extent->index << PAGE_SHIFT)), 0, (size_t) bytes);
+                        SetPageDirty(extent->first_page + (index - extent->index));
+                        extent->shadowed = min_t(unsigned long, extent->shadowed, index - extent->index);
+                        extent->last_access = jiffies;
+                }
+                pos += bytes;
+                size -= bytes;
+        }
+        return 0;
+}
+
+/*
+ * Extend the content of the session up to "size" bytes, as a write past its end
+ * or "ftruncate" do: the pages already in the buffer are cleared up to the new
+ * end, while the pages past the end of the buffer become a hole
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ * @size: new number of bytes of content in the session buffer
+ *
+ * Returns 0 if successful, -ENOMEM if not enough memory is available, or the
+ * error code returned while loading a page
+ */
+
+int session_extend_content(struct session *session, loff_t size){
+
+        /*
+         * Number of bytes of content in the session
+         */
+
+        loff_t content;
+
+        /*
+         * Number of pages needed by the new content
+         */
+
+        unsigned long nr_pages;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        content = session->filesize - session->base;
+        if (content < (loff_t) session->nr_pages << PAGE_SHIFT) {
+                ret = session_clear_buffer(session, content, min(size, (loff_t) session->nr_pages << PAGE_SHIFT) - content);
+                if (ret)
+                        return ret;
+        }
+        nr_pages = (unsigned long) ((size + PAGE_SIZE - 1) >> PAGE_SHIFT);
+        if (nr_pages > session->nr_pages)
+                return session_new_hole(session, nr_pages - session->nr_pages);
+        return 0;
+}
+
+/*
+ * Find the next byte of data or the next hole of the session, starting from a
+ * given offset. The end of the file counts as a hole; the content of an inline
+ * session and the part of an append-only session stored in the original file
+ * count as data
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ * @offset: offset within the file the search starts from
+ * @hole: true to look for a hole, false to look for data
+ *
+ * Returns the offset found, -ENXIO if the offset is past the end of the file or
+ * there's no data after it
+ */
+
+loff_t session_seek_hole(struct session *session, loff_t offset, bool hole){
+
+        /*
+         * Run of pages of the buffer used in the iteration
+         */
+
+        struct buffer_extent *extent;
+
+        /*
+         * Offset relative to the first byte stored in the session buffer
+         */
+
+        loff_t pos;
+
+        /*
+         * Offset of the first byte of the run
+         */
+
+        loff_t start;
+
+        if (offset >= session->filesize)
+                return -ENXIO;
+        if (offset < session->base) {
+                if (!hole)
+                        return offset;
+                offset = session->base;
+        }
+        if (session->inline_data)
+                return hole ? session->filesize : offset;
+        pos = offset - session->base;
+        extent = session_find_buffer_extent(session, (pgoff_t) (pos >> PAGE_SHIFT));
+        for (; extent && extent < session->extents + session->nr_extents; extent++) {
+                if (extent->hole != hole)
+                        continue;
+                start = max(pos, (loff_t) extent->index << PAGE_SHIFT);
+                if (start + session->base >= session->filesize)
+                        break;
+                return start + session->base;
+        }
+        return hole ? session->filesize : -ENXIO;
+}
+
+/*
+ * SPARSE SESSION BUFFER - end
+ */
+
+/*
+ * COPY SESSION BUFFER - start
+ *
+ * Copy bytes between the session buffer and a user-space buffer. The session buffer
+ * is scanned one run of contiguous pages (see "struct buffer_extent") at a time, and
+ * the requested bytes belonging to a run are transferred with a single call to
+ * "copy_to_user" or "copy_from_user", rather than one page at a time. Before being
+ * accessed, the pages of the run involved in the copy are loaded from the original
+ * file if needed. Writes of at least "session_nocache_threshold" bytes are copied with
+ * "__copy_from_user_nocache", that uses non-temporal stores where the architecture
+ * supports them. Reading a hole returns zeros, while the pages of a hole which
+ * are written are allocated first (see "session_fill_hole")
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ * @pos: offset of the first byte to be copied, relative to the first byte stored in
+ * the session buffer
+ * @buf: user-space buffer
+ * @size: number of bytes to be copied
+ * @write: true if bytes are copied from the user-space buffer into the session buffer,
+ * false if they are copied from the session buffer to the user-space buffer
+ *
+ * Returns 0 if all the bytes were copied, -EIO if the session buffer does not contain
+ * the requested bytes or some of them could not be copied, -EFAULT if the user-space
+ * buffer of a large write is not valid, or the error code returned while loading a page
+ *
+ * The content of an inline session is copied directly from or to its slab object
+ */
+
+int session_copy_buffer(struct session *session, loff_t pos, char __user *buf, size_t size, bool write){
+
+        /*
+         * Run of pages of the buffer used in the iteration
+         */
+
+        struct buffer_extent *extent;
+
+        /*
+         * Offsets, relative to the session buffer, of the first byte of the run
+         * and of the first byte after the run
+         */
+
+        loff_t extent_start;
+        loff_t extent_end;
+
+        /*
+         * Offset of the first byte of a page involved in the copy
+         */
+
+        loff_t page_start;
+
+        /*
+         * Index of a page involved in the copy
+         */
+
+        pgoff_t index;
+
+        /*
+         * Number of bytes copied with a single operation
+         */
+
+        size_t bytes;
+
+        /*
+         * Number of bytes that could not be copied
+         */
+
+        unsigned long failed;
+
+        /*
+         * True if the bytes have to be copied bypassing the CPU cache
+         */
+
+        bool nocache;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        /*
+         * The content of an inline session is not stored in pages
+         */
+
+        if (session->inline_data) {
+                if (pos + (loff_t) size > (loff_t) session->inline_size)
+                        return -EIO;
+                if (write)
+                        failed = copy_from_user(session->inline_data + pos, buf, size);
+                else
+                        failed = copy_to_user(buf, session->inline_data + pos, size);
+                if (failed) {
+                        printk(KERN_INFO "SESSION SEMANTICS->%lu bytes could not be copied\n", failed);
+                        return -EIO;
+                }
+                return 0;
+        }
+
+        /*
+         * Large writes bypass the CPU cache: "__copy_from_user_nocache" does not check
+         * the user-space buffer, so do it here once for the whole request
+         */
+
+        nocache = write && session_nocache_threshold > 0 && size >= (size_t) session_nocache_threshold;
+        if (nocache && !access_ok(VERIFY_READ, buf, size))
+                return -EFAULT;
+
+        /*
+         * Look for the run containing the requested offset, then scan the runs of
+         * pages in the order they appear in the buffer
+         */
+
+        extent = session_find_buffer_extent(session, (pgoff_t) (pos >> PAGE_SHIFT));
+        if (!extent)
+                return size ? -EIO : 0;
+        for (; extent < session->extents + session->nr_extents; extent++) {
+                extent_start = (loff_t) extent->index << PAGE_SHIFT;
+                extent_end = extent_start + ((loff_t) extent->nr_pages << PAGE_SHIFT);
+                while (size && pos >= extent_start && pos < extent_end) {
+
+                        /*
+                         * The pages of the run may have been released by the shrinker;
+                         * they may come back as several runs, so look for the run again
+                         */
+
+                        if (!extent->first_page && !extent->hole) {
+                                ret = session_reload_extent(session, &extent);
+                                if (ret)
+                                        return ret;
+                                extent = session_find_buffer_extent(session, (pgoff_t) (pos >> PAGE_SHIFT));
+                                extent_start = (loff_t) extent->index << PAGE_SHIFT;
+                                extent_end = extent_start + ((loff_t) extent->nr_pages << PAGE_SHIFT);
+                        }
+
+                        /*
+                         * Pages of a hole are allocated before being written; the
+                         * array of runs may be moved, so look for the run again
+                         */
+
+                        if (extent->hole && write) {
+                                ret = session_fill_hole(session, extent, (pgoff_t) (pos >> PAGE_SHIFT),
+                                                        (pgoff_t) ((pos + size - 1) >> PAGE_SHIFT));
+                                if (ret)
+                                        return ret;
+                                extent = session_find_buffer_extent(session, (pgoff_t) (pos >> PAGE_SHIFT));
+                                extent_start = (loff_t) extent->index << PAGE_SHIFT;
+                                extent_end = extent_start + ((loff_t) extent->nr_pages << PAGE_SHIFT);
+                        }
+                        extent->last_access = jiffies;
+
+                        /*
+                         * Copy all the requested bytes belonging to the current run; if
+                         * the module was asked to copy data one page at a time, stop at
+                         * the end of the current page instead
+                         */
+
+                        bytes = (size_t) min_t(loff_t, size, extent_end - pos);
+                        if (!session_run_copy)
+                                bytes = min_t(size_t, bytes, PAGE_SIZE - (size_t) (pos & ~PAGE_MASK));
+
+                        /*
+                         * Make sure the pages involved hold the content of the original
+                         * file, unless they are entirely overwritten; pages written are
+                         * marked as dirty, so that they are never released by the shrinker
+                         */
+
+                        for (index = pos >> PAGE_SHIFT; !extent->hole && index <= (pos + bytes - 1) >> PAGE_SHIFT; index++) {
+                                page_start = (loff_t) index << PAGE_SHIFT;
+                                ret = session_load_page(session, extent->first_page + (index - extent->index), index,
+                                                        write && pos <= page_start && pos + bytes >= page_start + PAGE_SIZE);
+                                if (ret)
+                                        return ret;
+                                if (write) {
+                                        SetPageDirty(extent->first_page + (index - extent->index));
+                                        extent->shadowed = min_t(unsigned long, extent->shadowed, index - extent->index);
+                                }
+                        }
+
+                        /*
+                         * Copy the bytes with a single operation
+                         */
+
+                        if (extent->hole)
+                                failed = clear_user(buf, bytes);
+                        else if (nocache)
+                                failed = __copy_from_user_nocache(extent->address + (pos - extent_start), buf, bytes);
+                        else if (write)
+                                failed = copy_from_user(extent->address + (pos - extent_start), buf, bytes);
+                        else
+                                failed = copy_to_user(buf, extent->address + (pos - extent_start), bytes);
+                        if (failed) {
+                                printk(KERN_INFO "SESSION SEMANTICS->%lu bytes could not be copied\n", failed);
+                                return -EIO;
+                        }
+
+                        /*
+                         * Move forward in both buffers
+                         */
+
+                        buf += bytes;
+                        pos += bytes;
+                        size -= bytes;
+                }
+                if (!size)
+                        break;
+        }
+
+        /*
+         * Check that the session buffer contained all the requested bytes
+         */
+
+        if (size)
+                return -EIO;
+        return 0;
+}
+
+/*
+ * COPY SESSION BUFFER - end
+ */
+
+/*
+ * EXPAND SESSION BUFFER - start
+ *
+ * Ask the system for the allocation of new pages, map them and add them to
+ * the buffer of the session object.
+ *
+ * Large requests are satisfied with 2 MB blocks of contiguous pages (order
+ * SESSION_HUGE_ORDER), each tracked by a single run of the buffer, while the
+ * remaining pages come from the smallest block covering them. A high-order block is asked
+ * for without retrying nor warning: if it's not available, blocks of smaller
+ * order are tried, down to single pages. Each block is split into independent
+ * pages, so that every page of the buffer can be released on its own.
+ *
+ * The buffer grows by the requested number of pages plus a margin of at most
+ * "session_growth_kb" KB: the pages of the last block beyond them are released
+ * right away, rather than rounding the buffer up to a power of two.
+ *
+ * Pages recycled from the pool of the current CPU are used first, then blocks are
+ * asked to the buddy allocator.
+ *
+ * Blocks are allocated on the NUMA node of the CPU which opened the session, so
+ * that accesses to the buffer don't cross the interconnect; if the buffer reaches
+ * "session_interleave_mb" MB, the blocks are spread round-robin over the online
+ * nodes instead
+ *
+ * @session: pointer to the object representing the current session
+ * @size: number of additional bytes that don't fit into the actual size of
+ * the buffer
+ * @grow: true if the growth margin is added to the buffer, false if the buffer
+ * has to grow by exactly the requested number of pages
+ *
+ * Returns the number of pages added if succeeds, -ENOMEM if not enough memory
+ * is available for the creation of the new object and -EINVAL if the given
+ * pointer is NULL. In case of error, the pages added before the failure stay
+ * in the session buffer, and they are released with it
+ */
+
+long session_expand_buffer(struct session* session, loff_t size, bool grow){
+
+        /*
+         * 2^(new_order) new pages are allocated at each iteration
+         */
+
+        unsigned int new_order;
+
+        /*
+         * Number of pages still to be allocated
+         */
+
+        unsigned long left;
+
+        /*
+         * Number of pages added to the buffer
+         */
+
+        unsigned long added;
+
+        /*
+         * Number of pages of the growth margin still to be allocated
+         */
+
+        unsigned long margin;
+
+        /*
+         * Number of pages of the newly allocated block kept in the buffer
+         */
+
+        unsigned long keep;
+
+        /*
+         * Index to iterate through newly allocated pages
+         */
+
+        unsigned long i;
+
+        /*
+         * Pointer to the descriptor of the first newly allocated page
+         */
+
+        struct page* new_first;
+
+        /*
+         * Run of contiguous pages corresponding to the newly allocated block
+         */
+
+        struct buffer_extent* extent;
+
+        /*
+         * True if the blocks have to be spread over the NUMA nodes
+         */
+
+        bool interleave;
+
+        /*
+         * NUMA node the next block is allocated on
+         */
+
+        int node;
+
+        /*
+         * Return value of the charge to the memory cgroup
+         */
+
+        int ret;
+
+        /*
+         * Check if parameters are valid
+         */
+
+        if (!session) {
+                printk(KERN_INFO "SESSION SEMANTICS->session_expand_buffer: session is NULL\n");
+                return -EINVAL;
+        }
+        if (size <= 0) {
+                printk(KERN_INFO "SESSION SEMANTICS->session_expand_buffer was passed 0 size\n");
+                return -EINVAL;
+        }
+
+        /*
+         * Get the number of pages necessary to store the requested amount of bytes
+         */
+
+        left = (unsigned long) ((size + PAGE_SIZE - 1) >> PAGE_SHIFT);
+        margin = grow && session_growth_kb > 0 ? (unsigned long) session_growth_kb >> (PAGE_SHIFT - 10) : 0;
+        added = 0;
+        interleave = session_interleave_mb > 0 &&
+                session->nr_pages + left >= (unsigned long) session_interleave_mb << (20 - PAGE_SHIFT);
+
+        while (left) {
+
+                /*
+                 * Get the order of the next block of pages, that is the smallest
+                 * one covering the pages still to be allocated and the margin, up
+                 * to a 2 MB block
+                 */
+
+                new_order = 0;
+                while ((1UL << new_order) < left + margin && new_order < min(SESSION_HUGE_ORDER, MAX_ORDER - 1))
+                        new_order++;
+
+                /*
+                 * Pick the node of the block: the home node of the session, or the
+                 * next online node when interleaving
+                 */
+
+                node = session->node;
+                if (interleave) {
+                        node = session->next_node;
+                        session->next_node = next_online_node(node);
+                        if (session->next_node >= MAX_NUMNODES)
+                                session->next_node = first_online_node;
+                }
+
+                /*
+                 * Take recycled pages of the chosen node, if any
+                 */
+
+                keep = session_pool_get(node, left + margin, &new_first);
+                if (keep)
+                        goto add_run;
+
+                /*
+                 * Allocate requested pages, preferably on the chosen node; if no
+                 * block of that order is readily available, fall back to smaller
+                 * blocks rather than making the allocator work hard
+                 */
+
+                for (;;) {
+                        if (new_order)
+                                new_first = alloc_pages_node(node, GFP_KERNEL | __GFP_NOWARN | __GFP_NORETRY, new_order);
+                        else
+                                new_first = alloc_pages_node(node, GFP_KERNEL, 0);
+                        if (new_first || !new_order)
+                                break;
+                        new_order--;
+                }
+                if (!new_first) {
+                        printk(KERN_INFO "SESSION SEMANTICS->session_expand_buffer could not allocate a page\n");
+                        return -ENOMEM;
+                }
+
+                /*
+                 * Turn the block into 2^(new_order) independent pages
+                 */
+
+                split_page(new_first, new_order);
+
+                /*
+                 * Keep only the pages of the block which are needed, plus the growth
+                 * margin, and release the others
+                 */
+
+                keep = min(1UL << new_order, left + margin);
+                for (i = keep; i < (1UL << new_order); i++)
+                        __free_page(new_first + i);
+
+add_run:
+
+                /*
+                 * Charge the pages to the memory cgroup of the current task
+                 */
+
+                ret = session_charge_pages(new_first, keep);
+                if (ret) {
+                        for (i = 0; i < keep; i++)
+                                __free_page(new_first + i);
+                        return ret;
+                }
+
+                /*
+                 * The pages of the block are contiguous in the virtual address space
+                 * too, so they form a run of the buffer which can be copied with a
+                 * single operation
+                 */
+
+                extent = session_new_buffer_extent(session, new_first, kmap(new_first));
+                if (IS_ERR(extent)) {
+                        session_uncharge_pages(new_first, keep);
+                        for (i = 0; i < keep; i++)
+                                __free_page(new_first + i);
+                        return PTR_ERR(extent);
+                }
+
+                /*
+                 * Add the pages kept to the buffer of the session
+                 */
+
+                for (i = 0; i < keep; i++) {
+
+                        /*
+                         * A page past the current content of the buffer has no counterpart
+                         * in the original file, so there's nothing to load into it; pages
+                         * holding original content are filled later (see "session_open")
+                         */
+
+                        if ((loff_t) session->nr_pages << PAGE_SHIFT >= session->filesize - session->base)
+                                SetPageUptodate(new_first + i);
+                        session->nr_pages++;
+                        extent->nr_pages++;
+                        atomic_long_inc(&session_node_pages[page_to_nid(new_first + i)]);
+                }
+
+                /*
+                 * Update the number of pages allocated so far
+                 */
+
+                added += keep;
+                if (keep > left)
+                        margin -= keep - left;
+                left -= min(left, keep);
+        }
+
+        /*
+         * Buffer was successfully expanded, so return number of new pages
+         */
+
+        printk(KERN_INFO "SESSION SEMANTICS->Expanded buffer: now there are %lu pages\n",session->nr_pages);
+        return (long) added;
+}
+
+/*
+ * EXPAND SESSION BUFFER - end
+ */
+
+/*
+ * CREATE SESSION BUFFER - start
+ *
+ * Allocate a suitable number of pages to store the content of the file in
+ * session. The buffer is built by "session_expand_buffer", so it may be made
+ * of several blocks of contiguous pages, since a single allocation can't be
+ * larger than 2^(MAX_ORDER-1) pages. If the file is empty or its content does
+ * not have to be stored (append-only session), only one page is allocated.
+ *
+ * The pages that are going to hold the original content of the file are not
+ * marked as up to date, because they still have to be filled.
+ *
+ * If the content to be stored is at most "session_inline_max" bytes, no page is
+ * allocated: the content is kept inline in a slab object sized to it.
+ *
+ * If the file is sparse, its holes become holes of the session buffer (see
+ * "session_new_hole"), so that no page is allocated for them
+ */
+
+/*
+ * Check if a page of the opened file is a hole, i.e. none of its blocks is mapped
+ * on the device and it's not in the page cache either (it may hold data not yet
+ * given a block). Filesystems that can't map their blocks have no holes
+ *
+ * @mapping: address_space of the opened file
+ * @index: index of the page within the file
+ *
+ * Returns true if the page is a hole
+ */
+
+bool session_hole_page(struct address_space *mapping, pgoff_t index){
+
+        /*
+         * Page of the page cache
+         */
+
+        struct page *page;
+
+        /*
+         * First block of the page, and index to iterate through its blocks
+         */
+
+        sector_t block;
+        unsigned long i;
+
+        if (!mapping->a_ops->bmap)
+                return false;
+        page = find_get_page(mapping, index);
+        if (page) {
+                page_cache_release(page);
+                return false;
+        }
+        block = (sector_t) index << (PAGE_SHIFT - mapping->host->i_blkbits);
+        for (i = 0; i < 1UL << (PAGE_SHIFT - mapping->host->i_blkbits); i++)
+                if (mapping->a_ops->bmap(mapping, block + i))
+                        return false;
+        return true;
+}
+
+/*
+ * Build the buffer of a sparse file: the pages of the file holding data are
+ * allocated, while its holes are added to the buffer as holes
+ *
+ * @session: pointer to the object representing the current session
+ * @mapping: address_space of the opened file
+ *
+ * Returns 0 in case of success, -ENOMEM if not enough memory is available
+ */
+
+int session_create_sparse_buffer(struct session *session, struct address_space *mapping){
+
+        /*
+         * Number of pages of the file, and index to iterate through them
+         */
+
+        pgoff_t nr_pages;
+        pgoff_t index;
+
+        /*
+         * Bytes of the file which are not backed by its blocks
+         */
+
+        loff_t unmapped;
+
+        /*
+         * Return value
+         */
+
+        long ret;
+
+        /*
+         * Whenever a hole is found, the pages of data before it are allocated,
+         * without any growth margin, so that the hole starts at the right page.
+         * Once the holes found cover all the bytes not backed by blocks, the rest
+         * of the file is data and its pages are not checked
+         */
+
+        nr_pages = (pgoff_t) ((session->filesize + PAGE_SIZE - 1) >> PAGE_SHIFT);
+        unmapped = session->filesize - ((loff_t) mapping->host->i_blocks << 9);
+        for (index = 0; index < nr_pages && unmapped > 0; index++) {
+                if (!session_hole_page(mapping, index))
+                        continue;
+                unmapped -= PAGE_SIZE;
+                if (index > session->nr_pages) {
+                        ret = session_expand_buffer(session, (loff_t) (index - session->nr_pages) << PAGE_SHIFT, false);
+                        if (ret < 0)
+                                return (int) ret;
+                }
+                ret = session_new_hole(session, 1);
+                if (ret)
+                        return (int) ret;
+        }
+
+        /*
+         * Allocate the pages of data after the last hole, if any
+         */
+
+        if (nr_pages > session->nr_pages) {
+                ret = session_expand_buffer(session, (loff_t) (nr_pages - session->nr_pages) << PAGE_SHIFT, true);
+                if (ret < 0)
+                        return (int) ret;
+        }
+        printk(KERN_INFO "SESSION SEMANTICS->Created sparse buffer of %lu pages, %lu in holes\n",session->nr_pages,session->nr_holes);
+        return 0;
+}
+
+/*
+ * Allocate the buffer of a new session
+ *
+ * @session: pointer to the object representing the current session; its fields
+ * "filesize" and "base" must have already been set
+ * @opened_file: file structure associated to opened file
+ *
+ * Returns 0 in case of success, -ENOMEM if not enough memory is available
+ */
+
+int session_create_buffer(struct session *session, struct file *opened_file){
+
+        /*
+         * Inode of the opened file
+         */
+
+        struct inode *inode;
+
+        /*
+         * Number of bytes the buffer has to store
+         */
+
+        loff_t size;
+
+        /*
+         * Return value from function to expand the session buffer
+         */
+
+        long ret;
+
+        /*
+         * Check size of the content to be stored
+         */
+
+        size = session->filesize - session->base;
+        if (session_inline_max > 0 && size <= min_t(loff_t, session_inline_max, PAGE_SIZE)) {
+
+                /*
+                 * Small content, keep it inline
+                 */
+
+                session->inline_data = kmalloc(max_t(size_t, (size_t) size, 1), GFP_KERNEL);
+                if (!session->inline_data)
+                        return -ENOMEM;
+                session->inline_size = ksize(session->inline_data);
+                printk(KERN_INFO "SESSION SEMANTICS->Created inline buffer of %zu bytes\n",session->inline_size);
+                return 0;
+        }
+        if (!size) {
+
+                /*
+                 * Nothing to store, allocate only one page
+                 */
+
+                printk(KERN_INFO "SESSION SEMANTICS-> File \"%s\" has no content to be stored in the buffer\n",session->filename);
+                size = PAGE_SIZE;
+        }
+
+        /*
+         * Make room for the hashes of the pages read from the file
+         */
+
+        session_alloc_hashes(session);
+
+        /*
+         * A file is sparse if its blocks can't hold all of its content
+         */
+
+        inode = opened_file->f_mapping->host;
+        if (!session->base && ((loff_t) inode->i_blocks << 9) < size)
+                return session_create_sparse_buffer(session, opened_file->f_mapping);
+
+        /*
+         * Allocate as many pages as necessary to store the content of the file
+         */
+
+        ret = session_expand_buffer(session, size, true);
+        if (ret < 0)
+                return (int) ret;
+        printk(KERN_INFO "SESSION SEMANTICS->Created buffer of %lu pages\n",session->nr_pages);
+        return 0;
+}
+
+/*
+ * CREATE SESSION BUFFER - end
+ */
+
+/*
+ * FLUSH SESSION BUFFER - start
+ *
+ * Write the first "size" bytes of the session buffer into the original file using
+ * the legacy "write" operation stored in the session object. Each run of contiguous
+ * pages of the buffer, or the inline storage of a small session, is handed to the
+ * legacy "write" as a whole
+ *
+ * Holes of the session are skipped, so they stay holes in the original file,
+ * which is truncated before being written; if the session ends with a hole, or
+ * the session is append-only, the file is extended past the hole.
+ *
+ * If the file was not modified since the session was opened, only the pages whose
+ * content changed are written into it, in place, and the file is not truncated
+ * (see "session_flush_changes").
+ *
+ * When the session is over, its pages are not copied: they are given to the page
+ * cache of the file in place of the pages dropped by the truncation, unless the
+ * session is append-only (its content does not start at a page boundary of the
+ * file) or the filesystem does not provide "write_begin" and "write_end"
+ *
+ * THESE HAVE TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT AND WITH THE
+ * KERNEL MEMORY SEGMENT SET, BECAUSE THE LEGACY "write" EXPECTS A USER-SPACE
+ * BUFFER
+ */
+
+/*
+ * Write a run of bytes of the session buffer into the original file
+ *
+ * @session: pointer to the object representing the current session
+ * @file: pointer to struct file of the opened file
+ * @src: address of the first byte of the run
+ * @bytes: number of bytes of the run
+ * @off: offset within the original file from which the run is written, moved
+ * forward by the number of bytes written
+ *
+ * Returns 0 if all the bytes were written, -EIO otherwise
+ */
+
+int session_flush_run(struct session *session, struct file *file, void *src, size_t bytes, loff_t *off){
+
+        /*
+         * Bytes written at each iteration
+         */
+
+        ssize_t written;
+
+        printk(KERN_INFO "SESSION SEMANTICS->Flushing run of bytes\nBytes to copy:%zu\nOffset:%lld\n",bytes,*off);
+        session->modified = true;
+        while (bytes) {
+                written = session->f_ops_old->write(file, src, bytes, off);
+
+                /*
+                 * If nothing could be flushed to the original file, return -EIO
+                 * (I/O error)
+                 */
+
+                if (written <= 0)
+                        return -EIO;
+                src += written;
+                bytes -= written;
+        }
+        return 0;
+}
+
+/*
+ * Set the size of the original file, working on the opened file rather than on
+ * its path, which may lead to a different file if the file was renamed while in
+ * session; this is what "ftruncate" does
+ *
+ * @file: pointer to struct file of the opened file
+ * @size: new size of the file
+ *
+ * Returns 0 if successful, or the error code returned by the filesystem
+ */
+
+int session_set_file_size(struct file *file, loff_t size){
+
+        /*
+         * Dentry of the opened file, and its inode
+         */
+
+        struct dentry *dentry;
+        struct inode *inode;
+
+        /*
+         * Attributes of the file to be changed
+         */
+
+        struct iattr attr;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        dentry = file->f_dentry;
+        inode = dentry->d_inode;
+        attr.ia_valid = ATTR_SIZE | ATTR_MTIME | ATTR_CTIME | ATTR_FILE;
+        attr.ia_size = size;
+        attr.ia_file = file;
+        mutex_lock(&inode->i_mutex);
+        ret = notify_change(dentry, &attr);
+        mutex_unlock(&inode->i_mutex);
+        return ret;
+}
+
+/*
+ * Allocate in advance the blocks of the original file which are going to be written
+ * by the commit, so that the filesystem allocates them with a single operation for
+ * each range of contiguous data, rather than a few pages at a time, as long as the
+ * filesystem supports "fallocate" and at least "session_prealloc_kb" KB are going
+ * to be written. The holes of the session are not allocated, and the size of the
+ * file is not changed. Any failure is ignored, since the blocks are allocated by
+ * the writes anyway
+ *
+ * @session: pointer to the object representing the current session
+ * @file: pointer to struct file of the opened file
+ * @off: offset within the original file of the first byte of the session buffer
+ * @from: offset within the session buffer of the first byte to be allocated
+ * @size: offset within the session buffer of the first byte not to be allocated
+ */
+
+void session_preallocate(struct session *session, struct file *file, loff_t off, loff_t from, loff_t size){
+
+        /*
+         * Inode of the opened file
+         */
+
+        struct inode *inode;
+
+        /*
+         * Run of pages of the buffer used in the iteration
+         */
+
+        struct buffer_extent *extent;
+
+        /*
+         * Bounds of the current run, and of the current range of contiguous data
+         * (start is -1 if there's no such range yet)
+         */
+
+        loff_t run_start;
+        loff_t run_end;
+        loff_t start;
+        loff_t end;
+
+        inode = file->f_dentry->d_inode;
+        if (session->inline_data || !inode->i_op->fallocate || session_prealloc_kb <= 0 ||
+            size - from < (loff_t) session_prealloc_kb << 10)
+                return;
+        start = -1;
+        end = 0;
+        for (extent = session->extents; extent <= session->extents + session->nr_extents; extent++) {
+
+                /*
+                 * A range of data ends at a hole, at the end of the range to be
+                 * allocated or at the end of the buffer
+                 */
+
+                if (extent < session->extents + session->nr_extents) {
+                        run_start = max((loff_t) extent->index << PAGE_SHIFT, from);
+                        run_end = min((loff_t) (extent->index + extent->nr_pages) << PAGE_SHIFT, size);
+                        if (run_end <= run_start)
+                                continue;
+                        if (!extent->hole) {
+                                if (start < 0)
+                                        start = run_start;
+                                end = run_end;
+                                continue;
+                        }
+                }
+                if (start < 0)
+                        continue;
+                inode->i_op->fallocate(inode, FALLOC_FL_KEEP_SIZE, off + start, end - start);
+                printk(KERN_INFO "SESSION SEMANTICS->Preallocated bytes %lld-%lld of file %s\n",off + start, off + end - 1, session->filename);
+                start = -1;
+        }
+}
+
+/*
+ * Write a page of the session buffer into the original file without copying it:
+ * the page is added to the page cache of the file and handed to the "write_begin"
+ * and "write_end" operations of the filesystem, that find it already up to date,
+ * allocate its blocks and mark it as dirty for the normal writeback. If the page
+ * can't be added to the page cache, e.g. because the page cache already holds a
+ * page at that offset, its content is copied into the page found by "write_begin".
+ * Either way, the session gives up the page
+ *
+ * @file: pointer to struct file of the opened file
+ * @page: page of the session buffer, no more charged to the session and with no
+ * mapping
+ * @len: number of bytes of content in the page
+ * @off: offset within the original file of the page, moved forward by "len"
+ *
+ * Returns 0 if the page was written, or the error code returned by the filesystem
+ */
+
+int session_donate_page(struct file *file, struct page *page, size_t len, loff_t *off){
+
+        /*
+         * address_space of the original file, and its inode
+         */
+
+        struct address_space *mapping;
+        struct inode *inode;
+
+        /*
+         * Page returned by "write_begin", and private data of the filesystem
+         */
+
+        struct page *cached;
+        void *fsdata;
+
+        /*
+         * True if the page was added to the page cache
+         */
+
+        bool donated;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        mapping = file->f_mapping;
+        inode = mapping->host;
+
+        /*
+         * The bytes past the content are cleared, then the page is stripped of the
+         * buffers attached to it by "readpage", which describe the blocks of the
+         * file before it was truncated, and of the flags left by the filesystem.
+         * The buffers are freed through "page->private", which is cleared only
+         * once they are gone; if they can't be freed, the page is copied instead
+         */
+
+        if (len < PAGE_SIZE)
+                memset(page_address(page) + len, 0, PAGE_SIZE - len);
+        ClearPageDirty(page);
+        if (PagePrivate(page)) {
+                __set_page_locked(page);
+                try_to_free_buffers(page);
+                __clear_page_locked(page);
+        }
+        if (!PagePrivate(page))
+                set_page_private(page, 0);
+        ClearPageMappedToDisk(page);
+        ClearPageChecked(page);
+        ClearPageError(page);
+        donated = false;
+        if (!PagePrivate(page) && !add_to_page_cache_lru(page, mapping, (pgoff_t) (*off >> PAGE_SHIFT), GFP_KERNEL)) {
+                unlock_page(page);
+                donated = true;
+        }
+
+        /*
+         * Let the filesystem prepare the page and mark it as dirty, holding the
+         * mutex of the inode as the legacy "write" does
+         */
+
+        mutex_lock(&inode->i_mutex);
+        ret = mapping->a_ops->write_begin(file, mapping, *off, (unsigned int) len, 0, &cached, &fsdata);
+        if (!ret) {
+                if (cached != page) {
+                        memcpy(kmap(cached), page_address(page), len);
+                        flush_dcache_page(cached);
+                        kunmap(cached);
+                }
+                ret = mapping->a_ops->write_end(file, mapping, *off, (unsigned int) len, (unsigned int) len, cached, fsdata);
+                ret = ret < 0 ? ret : ret != (int) len ? -EIO : 0;
+        }
+        mutex_unlock(&inode->i_mutex);
+
+        /*
+         * Drop the reference of the session: a donated page is now owned by the
+         * page cache
+         */
+
+        if (donated)
+                page_cache_release(page);
+        else
+                __free_page(page);
+        if (ret)
+                return ret;
+        *off += len;
+        balance_dirty_pages_ratelimited(mapping);
+        return 0;
+}
+
+/*
+ * Write the bytes of a run of pages of the session buffer into the original file
+ * giving away its pages (see "session_donate_page"); the pages of the run past its
+ * content are released, and the run is left without pages
+ *
+ * @session: pointer to the object representing the current session
+ * @file: pointer to struct file of the opened file
+ * @extent: run of pages to be written
+ * @bytes: number of bytes of the run to be written
+ * @off: offset within the original file from which the run is written, moved
+ * forward by the number of bytes written
+ *
+ * Returns 0 if all the bytes were written, or the error code returned by the
+ * filesystem
+ */
+
+int session_donate_run(struct session *session, struct file *file, struct buffer_extent *extent, size_t bytes, loff_t *off){
+
+        /*
+         * Page of the run used in the iteration
+         */
+
+        struct page *page;
+
+        /*
+         * Index to iterate through the pages of the run
+         */
+
+        unsigned long i;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        /*
+         * The pages filled by "readpage" still point to the address_space of the
+         * file: they must stop looking like page cache before they are uncharged
+         */
+
+        for (i = 0; i < extent->nr_pages; i++) {
+                extent->first_page[i].mapping = NULL;
+                atomic_long_dec(&session_node_pages[page_to_nid(extent->first_page + i)]);
+        }
+        session_uncharge_pages(extent->first_page, extent->nr_pages);
+        session->modified = true;
+        ret = 0;
+        file_update_time(file);
+        for (i = 0; i < extent->nr_pages; i++) {
+                page = extent->first_page + i;
+                if (!ret && bytes) {
+                        ret = session_donate_page(file, page, min_t(size_t, bytes, PAGE_SIZE), off);
+                        bytes -= min_t(size_t, bytes, PAGE_SIZE);
+                        continue;
+                }
+                __free_page(page);
+        }
+        extent->first_page = NULL;
+        extent->address = NULL;
+        session->nr_evicted += extent->nr_pages;
+        return ret;
+}
+
+/*
+ * Write the first "size" bytes of the session buffer into the original file
+ *
+ * @session: pointer to the object representing the current session
+ * @file: pointer to struct file of the opened file
+ * @off: offset within the original file from which the buffer is written
+ * @size: number of bytes of the session buffer to be written
+ * @donate: true if the session is over, so its pages can be given away
+ *
+ * Returns 0 if all the bytes were written, -EIO otherwise, or the error code
+ * returned while extending the file
+ */
+
+int session_flush_buffer(struct session *session, struct file *file, loff_t off, loff_t size, bool donate){
+
+        /*
+         * Next run of pages from the buffer to be flushed into the original file
+         */
+
+        struct buffer_extent* extent;
+
+        /*
+         * Bytes of the current run to be written
+         */
+
+        size_t bytes;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        /*
+         * The inline storage of a small session is flushed as a single run
+         */
+
+        if (session->inline_data) {
+                if (size > (loff_t) session->inline_size)
+                        return -EIO;
+                return session_flush_run(session, file, session->inline_data, (size_t) size, &off);
+        }
+
+        /*
+         * Write the runs of the buffer in the order they appear in the session
+         * object, until "size" bytes have been flushed: only the last run may be
+         * partially written
+         */
+
+        session_preallocate(session, file, off, 0, size);
+        donate = donate && session_donate_pages && !session->append &&
+                file->f_mapping->a_ops->write_begin && file->f_mapping->a_ops->write_end;
+
+        for (extent = session->extents; extent < session->extents + session->nr_extents; extent++) {
+                if (!size)
+                        break;
+                bytes = (size_t) min_t(loff_t, size, (loff_t) extent->nr_pages << PAGE_SHIFT);
+                if (extent->hole) {
+                        off += bytes;
+                        size -= bytes;
+
+                        /*
+                         * Nothing is written after a hole at the end of the session,
+                         * and the legacy "write" of an append-only session ignores the
+                         * offset: set the size of the file to the end of the hole
+                         */
+
+                        if (!size || session->append) {
+                                session->modified = true;
+                                ret = session_set_file_size(file, off);
+                                if (ret)
+                                        return ret;
+                        }
+                        continue;
+                }
+                ret = session_reload_extent(session, &extent);
+                if (ret)
+                        return ret;
+                bytes = (size_t) min_t(loff_t, size, (loff_t) extent->nr_pages << PAGE_SHIFT);
+                if (donate)
+                        ret = session_donate_run(session, file, extent, bytes, &off);
+                else
+                        ret = session_flush_run(session, file, extent->address, bytes, &off);
+                if (ret)
+                        return ret;
+                size -= bytes;
+        }
+
+        /*
+         * Check that the buffer contained all the requested bytes
+         */
+
+        if (size)
+                return -EIO;
+        return 0;
+}
+
+/*
+ * Write into the original file only the content of the session that changed since
+ * the session was opened, leaving the rest of the file alone: the pages whose
+ * content is unchanged (see "session_page_unchanged") are skipped, the changed
+ * ones are written in place, in runs of contiguous pages, and finally the size of
+ * the file is set to the size of the session, if they differ. This is possible only
+ * if the file was not modified since the session was opened and the session did
+ * not release any of its original content (see "struct session"); if nothing
+ * changed, the file is not touched at all
+ *
+ * @session: pointer to the object representing the current session
+ * @file: pointer to struct file of the opened file
+ *
+ * Returns 0 if all the changed bytes were written, -EIO otherwise, or the error
+ * code returned while setting the size of the file
+ */
+
+int session_flush_changes(struct session *session, struct file *file){
+
+        /*
+         * Run of pages of the buffer used in the iteration
+         */
+
+        struct buffer_extent *extent;
+
+        /*
+         * Number of bytes of content in the session
+         */
+
+        loff_t content;
+
+        /*
+         * Index of a page within the current run, and index of the first page of
+         * the pending run of changed pages
+         */
+
+        unsigned long i;
+        unsigned long start;
+
+        /*
+         * Offset within the original file of the pending run of changed pages, and
+         * number of bytes of the run
+         */
+
+        loff_t off;
+        size_t bytes;
+
+        /*
+         * Number of pages written
+         */
+
+        unsigned long written;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        content = session->filesize;
+        written = 0;
+        ret = 0;
+
+        /*
+         * The inline storage of a small session is written as a whole, if it changed
+         */
+
+        if (session->inline_data) {
+                if (content != session->snapshot_size || !session->inline_hash ||
+                    session->inline_hash != session_hash(session->inline_data, (size_t) content)) {
+                        off = 0;
+                        ret = session_flush_run(session, file, session->inline_data, (size_t) content, &off);
+                        written = 1;
+                }
+        }
+
+        /*
+         * The runs of pages of the buffer, if any, are written after allocating
+         * the blocks past the original end of the file
+         */
+
+        session_preallocate(session, file, 0, session->snapshot_size, content);
+        for (extent = session->extents; !ret && extent < session->extents + session->nr_extents; extent++) {
+
+                /*
+                 * Holes were holes of the file, or they are past its end, and runs
+                 * released by the shrinker or compressed without being written
+                 * still hold the original content
+                 */
+
+                if ((loff_t) extent->index << PAGE_SHIFT >= content)
+                        break;
+                if (extent->hole || (!extent->first_page && (!extent->compressed || !extent->compressed_dirty)))
+                        continue;
+                ret = session_reload_extent(session, &extent);
+
+                /*
+                 * Collect the changed pages of the run into runs of contiguous
+                 * pages, each written as soon as an unchanged page, the end of the
+                 * run or the end of the content is reached
+                 */
+
+                start = extent->nr_pages;
+                for (i = 0; !ret && i <= extent->nr_pages; i++) {
+                        if (i < extent->nr_pages && ((loff_t) (extent->index + i) << PAGE_SHIFT) < content &&
+                            !session_page_unchanged(session, extent->first_page + i, extent->index + i)) {
+                                if (start == extent->nr_pages)
+                                        start = i;
+                                continue;
+                        }
+                        if (start == extent->nr_pages)
+                                continue;
+                        off = (loff_t) (extent->index + start) << PAGE_SHIFT;
+                        bytes = (size_t) min_t(loff_t, (loff_t) (i - start) << PAGE_SHIFT, content - off);
+                        ret = session_flush_run(session, file, extent->address + (start << PAGE_SHIFT), bytes, &off);
+                        written += i - start;
+                        start = extent->nr_pages;
+                }
+        }
+        if (ret)
+                return ret;
+
+        /*
+         * Then the file takes the size of the session
+         */
+
+        if (content != session->snapshot_size) {
+                session->modified = true;
+                ret = session_set_file_size(file, content);
+                if (ret)
+                        return ret;
+        }
+        if (!written && content == session->snapshot_size)
+                printk(KERN_INFO "SESSION SEMANTICS->Content of file %s did not change, nothing to commit\n",session->filename);
+        else
+                printk(KERN_INFO "SESSION SEMANTICS->Wrote %lu changed pages into file %s\n",written,session->filename);
+        return 0;
+}
+
+/*
+ * FLUSH SESSION BUFFER - end
+ */
+
+/*
+ * FREE SESSION BUFFER - start
+ *
+ * Release all the pages of the session buffer together with the array of
+ * runs of pages used to keep track of them, or the inline storage of a small
+ * session
+ *
+ * @session: pointer to the object representing the current session
+ */
+
+void session_free_buffer(struct session *session) {
+
+        /*
+         * Pointer used to iterate through the runs of pages
+         */
+
+        struct buffer_extent* extent;
+
+        /*
+         * Index of a page within the current run
+         */
+
+        unsigned long i;
+
+        /*
+         * Iterate through the runs of pages stored in the session object
+         * and for each page of a run:
+         *
+         * 1- set the "mapping" field of its descriptor to NULL, otherwise
+         * "free_page" complains because the descriptor is still in use
+         *
+         * 2- release the frame associated to the page, or keep it for
+         * reuse (see "session_pool_put")
+         */
+
+        for (extent = session->extents; extent < session->extents + session->nr_extents; extent++) {
+
+                /*
+                 * A compressed run has no pages, only its compressed content
+                 */
+
+                if (!extent->first_page) {
+                        if (extent->compressed) {
+                                atomic_long_sub(extent->nr_pages << PAGE_SHIFT, &session_compressed_bytes);
+                                atomic_long_sub(extent->compressed_len, &session_compressed_size);
+                                vfree(extent->compressed);
+                        }
+                        continue;
+                }
+                for (i = 0; i < extent->nr_pages; i++) {
+                        extent->first_page[i].mapping=NULL;
+                        atomic_long_dec(&session_node_pages[page_to_nid(extent->first_page + i)]);
+                }
+
+                /*
+                 * Give the run to the pool of the current CPU, or release its
+                 * pages if the pool does not take it; either way, the pages are
+                 * not charged to the cgroup of the session anymore
+                 */
+
+                session_uncharge_pages(extent->first_page, extent->nr_pages);
+                if (session_pool_put(extent->first_page, extent->nr_pages))
+                        continue;
+                for (i = 0; i < extent->nr_pages; i++)
+                        __free_page(extent->first_page + i);
+        }
+
+        /*
+         * Release the array of runs itself
+         */
+
+        kfree(session->extents);
+        kfree(session->inline_data);
+        session_free_hashes(session);
+        session->inline_data = NULL;
+        session->inline_size = 0;
+        session->extents = NULL;
+        session->nr_extents = 0;
+        session->max_extents = 0;
+        session->nr_pages = 0;
+        session->nr_evicted = 0;
+        session->nr_compressed = 0;
+        session->nr_holes = 0;
+}
+
+/*
+ * FREE SESSION BUFFER - end
+ */
+
+/*
+ * INLINE SESSION BUFFER - start
+ *
+ * The content of a small session (at most "session_inline_max" bytes) is kept
+ * inline in a slab object sized to the content, rather than in pages. The
+ * following functions load the original content of the file into the object
+ * and make room for a write, moving the content into pages if it outgrows the
+ * inline storage
+ */
+
+/*
+ * Copy the content of the opened file into the inline storage of the session.
+ * The content is read into a temporary page with "session_fill_page", like any
+ * page of the buffer, then copied into the slab object
+ *
+ * @session: pointer to the object representing the current session
+ * @opened_file: file structure associated to opened file
+ *
+ * Returns 0 if the content is copied, an error code otherwise
+ */
+
+int session_fill_inline(struct session *session, struct file *opened_file){
+
+        /*
+         * Temporary page the content of the file is read into
+         */
+
+        struct page *page;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        page = alloc_page(GFP_KERNEL);
+        if (!page)
+                return -ENOMEM;
+        ret = session_fill_page(page, 0, opened_file);
+        if (!ret) {
+                memcpy(session->inline_data, page_address(page), (size_t) (session->filesize - session->base));
+                session->inline_hash = session_hash(session->inline_data, (size_t) (session->filesize - session->base));
+        }
+        page->mapping = NULL;
+        __free_page(page);
+        return ret;
+}
+
+/*
+ * Make sure that the inline storage of the session can hold "size" bytes: the
+ * slab object is enlarged as long as "size" does not exceed "session_inline_max",
+ * otherwise the content is moved into newly allocated pages and the session
+ * stops using the inline storage
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ * @size: number of bytes the buffer has to hold
+ *
+ * Returns 0 if successful, -ENOMEM if not enough memory is available
+ */
+
+int session_grow_inline(struct session *session, loff_t size){
+
+        /*
+         * Enlarged slab object, or the slab object being moved into pages
+         */
+
+        char *inline_data;
+
+        /*
+         * Size of the slab object being moved into pages
+         */
+
+        size_t inline_size;
+
+        /*
+         * Return value from function to expand the session buffer
+         */
+
+        long ret;
+
+        /*
+         * Number of bytes of content in the session
+         */
+
+        loff_t content;
+
+        content = session->filesize - session->base;
+
+        /*
+         * Still small enough: enlarge the slab object if needed, and clear the
+         * bytes between the end of the content and the end of the write, so that
+         * a write past the end of the file leaves no garbage behind
+         */
+
+        if (size <= (loff_t) session->inline_size ||
+            (session_inline_max > 0 && size <= min_t(loff_t, session_inline_max, PAGE_SIZE))) {
+                if (size > (loff_t) session->inline_size) {
+                        inline_data = krealloc(session->inline_data, (size_t) size, GFP_KERNEL);
+                        if (!inline_data)
+                                return -ENOMEM;
+                        session->inline_data = inline_data;
+                        session->inline_size = ksize(inline_data);
+                }
+                if (size > content)
+                        memset(session->inline_data + content, 0, (size_t) (size - content));
+                return 0;
+        }
+
+        /*
+         * Move the content into pages: the first page of the buffer receives the
+         * whole inline content, so it's up to date. Only the first page is added
+         * here, the caller adds the pages needed by the write and the holes before
+         * them
+         */
+
+        printk(KERN_INFO "SESSION SEMANTICS->Moving inline session of %zu bytes into pages\n",session->inline_size);
+        inline_data = session->inline_data;
+        inline_size = session->inline_size;
+        session->inline_data = NULL;
+        session->inline_size = 0;
+        ret = session_expand_buffer(session, min_t(loff_t, size, PAGE_SIZE), true);
+
+        /*
+         * If the pages could not be allocated, release those added so far and keep
+         * using the inline storage
+         */
+
+        if (ret < 0) {
+                session_free_buffer(session);
+                session->inline_data = inline_data;
+                session->inline_size = inline_size;
+                return (int) ret;
+        }
+        memcpy(session->extents[0].address, inline_data, (size_t) content);
+        SetPageUptodate(session->extents[0].first_page);
+        SetPageDirty(session->extents[0].first_page);
+        kfree(inline_data);
+        return 0;
+}
+
+/*
+ * INLINE SESSION BUFFER - end
+ */
+
+/*
+ * SHADOW FILE - start
+ *
+ * Committing a large session may mean writing gigabytes into the original file
+ * when the session is closed. If "session_shadow_secs" is set, a background work
+ * periodically looks for sessions which are going to rewrite the whole file (see
+ * "session_commit") and were not accessed for that number of seconds, and writes
+ * their pages into a shadow file, created in the directory of the original file
+ * with a hidden name; the shadow file is not visible under the name of the file,
+ * so the session semantics is preserved. When the session is closed, only the
+ * pages written after they were copied into the shadow file are left to write,
+ * and then the shadow file is renamed over the original file.
+ *
+ * Each run of the buffer keeps the number of its first pages whose content is in
+ * the shadow file (see "struct buffer_extent"), which drops to the index of any
+ * page of the run written afterwards, so that the pages from there on are written
+ * into the shadow file again. Runs released by the shrinker or compressed keep
+ * their content, so they keep their count as well. The shadow file is discarded
+ * if the session punches or truncates away some of its content, and it's never
+ * used for files with several hard links, owned by someone else than the process
+ * which opened the session or written by other processes, since renaming it would
+ * change them
+ */
+
+/*
+ * Sequence number making the names of the shadow files unique
+ */
+
+atomic_t session_shadow_seq = ATOMIC_INIT(0);
+
+/*
+ * Background work writing idle sessions into their shadow files, and the workqueue
+ * it runs on: the work blocks on file I/O, so it does not use the shared one
+ */
+
+struct delayed_work session_shadow_work;
+struct workqueue_struct *session_shadow_wq;
+
+/*
+ * Maximum number of pages of a session written into its shadow file by each
+ * scan, so that the mutex of the session is not held for too long; if a session
+ * has more pages to write, the next scan follows shortly
+ */
+
+#define SESSION_SHADOW_BATCH (1UL << SESSION_HUGE_ORDER)
+
+/*
+ * Remove the shadow file of a session, if any: none of the pages of the session is
+ * in a shadow file anymore
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ */
+
+void session_shadow_discard(struct session *session){
+
+        /*
+         * Dentry of the shadow file, and of its directory
+         */
+
+        struct dentry *shadow_dentry;
+        struct dentry *parent;
+
+        /*
+         * Mount point of the shadow file
+         */
+
+        struct vfsmount *mnt;
+
+        /*
+         * Credentials of the caller, replaced by those of the process which opened
+         * the session
+         */
+
+        const struct cred *old_cred;
+
+        /*
+         * Run of pages of the buffer used in the iteration
+         */
+
+        struct buffer_extent *extent;
+
+        if (!session->shadow)
+                return;
+        shadow_dentry = session->shadow->f_dentry;
+        mnt = session->shadow->f_vfsmnt;
+        old_cred = override_creds(session->file->f_cred);
+        parent = dget_parent(shadow_dentry);
+        if (!mnt_want_write(mnt)) {
+                mutex_lock_nested(&parent->d_inode->i_mutex, I_MUTEX_PARENT);
+                if (!d_unhashed(shadow_dentry) && shadow_dentry->d_parent == parent)
+                        vfs_unlink(parent->d_inode, shadow_dentry);
+                mutex_unlock(&parent->d_inode->i_mutex);
+                mnt_drop_write(mnt);
+        }
+        dput(parent);
+        revert_creds(old_cred);
+        fput(session->shadow);
+        session->shadow = NULL;
+        for (extent = session->extents; extent < session->extents + session->nr_extents; extent++)
+                extent->shadowed = 0;
+        printk(KERN_INFO "SESSION SEMANTICS->Discarded shadow file of file %s\n",session->filename);
+}
+
+/*
+ * Create the shadow file of a session in the directory of the original file, with
+ * the credentials of the process which opened the session and the permissions of
+ * the original file
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ *
+ * Returns the opened shadow file, or an error pointer if the file can't be created
+ * or its owner and group can't be those of the original file
+ */
+
+struct file *session_shadow_open(struct session *session){
+
+        /*
+         * Dentry and inode of the original file, and of its directory
+         */
+
+        struct dentry *dentry;
+        struct inode *inode;
+        struct dentry *parent;
+        struct inode *dir;
+
+        /*
+         * Dentry of the shadow file, and the file opened on it
+         */
+
+        struct dentry *shadow_dentry;
+        struct file *shadow;
+
+        /*
+         * Mount point of the original file
+         */
+
+        struct vfsmount *mnt;
+
+        /*
+         * Credentials of the work, replaced by those of the process which opened
+         * the session
+         */
+
+        const struct cred *old_cred;
+
+        /*
+         * Name of the shadow file
+         */
+
+        char name[48];
+
+        /*
+         * Owner and group of the original file
+         */
+
+        struct iattr attr;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        dentry = session->file->f_dentry;
+        inode = dentry->d_inode;
+        mnt = session->file->f_vfsmnt;
+        if (inode->i_nlink != 1 || session->file->f_cred->fsuid != inode->i_uid ||
+            atomic_read(&inode->i_writecount) > 1)
+                return ERR_PTR(-EPERM);
+        snprintf(name, sizeof(name), ".session-%lu-%d", inode->i_ino, atomic_inc_return(&session_shadow_seq));
+
+        /*
+         * Create the file as the process which opened the session would do
+         */
+
+        old_cred = override_creds(session->file->f_cred);
+        parent = dget_parent(dentry);
+        dir = parent->d_inode;
+        ret = mnt_want_write(mnt);
+        if (ret) {
+                shadow = ERR_PTR(ret);
+                goto out;
+        }
+        mutex_lock_nested(&dir->i_mutex, I_MUTEX_PARENT);
+        shadow_dentry = lookup_one_len(name, parent, strlen(name));
+        if (IS_ERR(shadow_dentry))
+                ret = PTR_ERR(shadow_dentry);
+        else {
+                ret = d_unhashed(dentry) ? -ENOENT : vfs_create(dir, shadow_dentry, inode->i_mode & S_IALLUGO, NULL);
+                if (ret)
+                        dput(shadow_dentry);
+        }
+        mutex_unlock(&dir->i_mutex);
+        mnt_drop_write(mnt);
+        if (ret) {
+                shadow = ERR_PTR(ret);
+                goto out;
+        }
+        shadow = dentry_open(shadow_dentry, mntget(mnt), O_RDWR | O_LARGEFILE, session->file->f_cred);
+        if (IS_ERR(shadow))
+                goto out;
+
+        /*
+         * The group of the file depends on the directory: give it the group of the
+         * original file, or give up the shadow file
+         */
+
+        if (shadow->f_dentry->d_inode->i_gid != inode->i_gid) {
+                attr.ia_valid = ATTR_GID;
+                attr.ia_gid = inode->i_gid;
+                mutex_lock(&shadow->f_dentry->d_inode->i_mutex);
+                ret = notify_change(shadow->f_dentry, &attr);
+                mutex_unlock(&shadow->f_dentry->d_inode->i_mutex);
+                if (ret) {
+                        revert_creds(old_cred);
+                        dput(parent);
+                        session->shadow = shadow;
+                        session_shadow_discard(session);
+                        return ERR_PTR(ret);
+                }
+        }
+        printk(KERN_INFO "SESSION SEMANTICS->Created shadow file %s for file %s\n",name,session->filename);
+out:
+        revert_creds(old_cred);
+        dput(parent);
+        return shadow;
+}
+
+/*
+ * Write the pages of the session whose content is not in the shadow file yet into
+ * the shadow file, at their offset: for each run, the pages past those already in
+ * the shadow file are written as a whole. The pages which were never loaded are
+ * loaded first; the runs released by the shrinker or compressed are reloaded only
+ * if all the pages have to be written
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT AND WITH THE
+ * KERNEL MEMORY SEGMENT SET
+ *
+ * @session: pointer to the object representing the current session
+ * @nr_to_write: maximum number of pages to be written
+ * @all: true if all the pages have to be written, since the session is being
+ * committed
+ *
+ * Returns the number of pages written, or the error code returned while loading a
+ * page or writing the shadow file
+ */
+
+long session_shadow_write(struct session *session, unsigned long nr_to_write, bool all){
+
+        /*
+         * Run of pages of the buffer used in the iteration
+         */
+
+        struct buffer_extent *extent;
+
+        /*
+         * Number of bytes of content in the session
+         */
+
+        loff_t content;
+
+        /*
+         * Index of a page within the current run, and bounds of the pages of the
+         * run to be written
+         */
+
+        unsigned long i;
+        unsigned long start;
+        unsigned long end;
+
+        /*
+         * Offset of the pages within the shadow file, and number of bytes still to
+         * be written
+         */
+
+        loff_t off;
+        size_t bytes;
+
+        /*
+         * Bytes written by the legacy "write", and address of the next byte to be
+         * written
+         */
+
+        ssize_t written;
+        void *src;
+
+        /*
+         * Number of pages written
+         */
+
+        unsigned long nr_written;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        content = session->filesize;
+        nr_written = 0;
+        ret = 0;
+        for (extent = session->extents; !ret && extent < session->extents + session->nr_extents; extent++) {
+                if ((loff_t) extent->index << PAGE_SHIFT >= content || nr_written >= nr_to_write)
+                        break;
+                if (extent->hole || (!extent->first_page && !all))
+                        continue;
+
+                /*
+                 * Pages of the run past those in the shadow file, within the content
+                 * of the session
+                 */
+
+                start = extent->shadowed;
+                end = min_t(unsigned long, extent->nr_pages,
+                            (unsigned long) (((content + PAGE_SIZE - 1) >> PAGE_SHIFT) - extent->index));
+                end = min(end, start + (nr_to_write - nr_written));
+                if (start >= end)
+                        continue;
+                ret = session_reload_extent(session, &extent);
+                end = min(end, extent->nr_pages);
+                if (!ret && start >= end)
+                        continue;
+                for (i = start; !ret && i < end; i++)
+                        ret = session_load_page(session, extent->first_page + i, extent->index + i, false);
+                if (ret)
+                        break;
+
+                /*
+                 * Write the pages into the shadow file
+                 */
+
+                off = (loff_t) (extent->index + start) << PAGE_SHIFT;
+                bytes = (size_t) min_t(loff_t, (loff_t) (end - start) << PAGE_SHIFT, content - off);
+                src = extent->address + (start << PAGE_SHIFT);
+                while (bytes) {
+                        written = session->shadow->f_op->write(session->shadow, src, bytes, &off);
+                        if (written <= 0) {
+                                ret = -EIO;
+                                break;
+                        }
+                        src += written;
+                        bytes -= written;
+                }
+                if (!ret) {
+                        extent->shadowed = end;
+                        nr_written += end - start;
+                }
+        }
+        return ret ? ret : (long) nr_written;
+}
+
+/*
+ * Give the shadow file of a session the owner, group and permissions that the
+ * original file has now, as well as its extended attributes, which include its
+ * access control lists, so that renaming the shadow file does not change them
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT AND WITH THE
+ * CREDENTIALS OF THE PROCESS WHICH OPENED THE SESSION
+ *
+ * @session: pointer to the object representing the current session
+ *
+ * Returns 0 if successful, -ENOMEM if not enough memory is available, or the error
+ * code returned while reading or setting an attribute
+ */
+
+int session_shadow_copy_attrs(struct session *session){
+
+        /*
+         * Dentry of the original file and of the shadow file, and inode of the
+         * original file
+         */
+
+        struct dentry *dentry;
+        struct dentry *shadow_dentry;
+        struct inode *inode;
+
+        /*
+         * Owner, group and permissions of the original file
+         */
+
+        struct iattr attr;
+
+        /*
+         * Names of the extended attributes, the one used in the iteration and its
+         * value
+         */
+
+        char *names;
+        char *name;
+        void *value;
+
+        /*
+         * Length of the names, and size of the value
+         */
+
+        ssize_t len;
+        ssize_t size;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        dentry = session->file->f_dentry;
+        inode = dentry->d_inode;
+        shadow_dentry = session->shadow->f_dentry;
+        attr.ia_valid = ATTR_UID | ATTR_GID | ATTR_MODE;
+        attr.ia_uid = inode->i_uid;
+        attr.ia_gid = inode->i_gid;
+        attr.ia_mode = inode->i_mode;
+        mutex_lock(&shadow_dentry->d_inode->i_mutex);
+        ret = notify_change(shadow_dentry, &attr);
+        mutex_unlock(&shadow_dentry->d_inode->i_mutex);
+        if (ret)
+                return ret;
+
+        /*
+         * Copy the extended attributes one by one, if the filesystem has any
+         */
+
+        len = vfs_listxattr(dentry, NULL, 0);
+        if (len <= 0)
+                return len == -EOPNOTSUPP ? 0 : (int) len;
+        names = kmalloc(len, GFP_KERNEL);
+        if (!names)
+                return -ENOMEM;
+        len = vfs_listxattr(dentry, names, len);
+        ret = len < 0 ? (int) len : 0;
+        for (name = names; !ret && name < names + len; name += strlen(name) + 1) {
+                size = vfs_getxattr(dentry, name, NULL, 0);
+                if (size < 0) {
+                        ret = (int) size;
+                        break;
+                }
+                value = kmalloc(max_t(size_t, size, 1), GFP_KERNEL);
+                if (!value) {
+                        ret = -ENOMEM;
+                        break;
+                }
+                size = vfs_getxattr(dentry, name, value, size);
+                ret = size < 0 ? (int) size : vfs_setxattr(shadow_dentry, name, value, size, 0);
+                kfree(value);
+        }
+        kfree(names);
+        return ret;
+}
+
+/*
+ * Commit a session through its shadow file: the pages whose content is not in the
+ * shadow file yet are written into it, the shadow file takes the size and the
+ * attributes of the original file (see "session_shadow_copy_attrs") and it's
+ * renamed over the original file, which is left to the opened file only.
+ * Processes which are reading the original file keep reading its old content
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT AND WITH THE
+ * KERNEL MEMORY SEGMENT SET
+ *
+ * @session: pointer to the object representing the current session
+ *
+ * Returns 0 if successful, -EBUSY if other processes are writing the original
+ * file or it has several hard links, -ESTALE if the original file was renamed or
+ * removed, or the error code returned while writing the shadow file, copying the
+ * attributes or renaming it; the original file is untouched in case of error
+ */
+
+int session_shadow_commit(struct session *session){
+
+        /*
+         * Dentry of the original file and of the shadow file, and of their
+         * directory
+         */
+
+        struct dentry *dentry;
+        struct dentry *shadow_dentry;
+        struct dentry *parent;
+
+        /*
+         * Mount point of the files
+         */
+
+        struct vfsmount *mnt;
+
+        /*
+         * Credentials of the caller, replaced by those of the process which opened
+         * the session
+         */
+
+        const struct cred *old_cred;
+
+        /*
+         * Return value
+         */
+
+        long ret;
+
+        /*
+         * Other processes writing the original file would keep writing it after
+         * the rename, and their changes would be lost; the other hard links of the
+         * file, if any were added since the session was opened, would keep its
+         * old content
+         */
+
+        dentry = session->file->f_dentry;
+        if (atomic_read(&dentry->d_inode->i_writecount) > 1 || dentry->d_inode->i_nlink != 1)
+                return -EBUSY;
+        ret = session_shadow_write(session, ULONG_MAX, true);
+        if (ret >= 0) {
+                printk(KERN_INFO "SESSION SEMANTICS->Wrote %ld pages into the shadow file of file %s\n",ret,session->filename);
+                ret = session_set_file_size(session->shadow, session->filesize);
+        }
+        if (ret)
+                return (int) ret;
+
+        /*
+         * Copy the attributes of the original file, then rename the shadow file
+         * over it, as long as they are still in the same directory
+         */
+
+        shadow_dentry = session->shadow->f_dentry;
+        mnt = session->file->f_vfsmnt;
+        old_cred = override_creds(session->file->f_cred);
+        parent = dget_parent(dentry);
+        ret = mnt_want_write(mnt);
+        if (!ret) {
+                ret = session_shadow_copy_attrs(session);
+                if (!ret) {
+                        lock_rename(parent, parent);
+                        if (d_unhashed(dentry) || d_unhashed(shadow_dentry) || shadow_dentry->d_parent != parent)
+                                ret = -ESTALE;
+                        else
+                                ret = vfs_rename(parent->d_inode, shadow_dentry, parent->d_inode, dentry);
+                        unlock_rename(parent, parent);
+                }
+                mnt_drop_write(mnt);
+        }
+        dput(parent);
+        revert_creds(old_cred);
+        if (ret)
+                return (int) ret;
+        fput(session->shadow);
+        session->shadow = NULL;
+        printk(KERN_INFO "SESSION SEMANTICS->Renamed the shadow file over file %s\n",session->filename);
+        return 0;
+}
+
+/*
+ * Write the pages of a session into its shadow file if the session is going to
+ * rewrite the whole file and it was not accessed for the given time, creating the
+ * shadow file the first time
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ * @idle: number of jiffies since the last access after which the session is
+ * written
+ *
+ * Returns the number of pages written
+ */
+
+unsigned long session_shadow_session(struct session *session, unsigned long idle){
+
+        /*
+         * Run of pages of the buffer used in the iteration
+         */
+
+        struct buffer_extent *extent;
+
+        /*
+         * Memory segment of the work
+         */
+
+        mm_segment_t segment;
+
+        /*
+         * Number of pages written, or error code
+         */
+
+        long ret;
+
+        /*
+         * Sessions committed in place, or without a whole page, don't need a
+         * shadow file
+         */
+
+        if (!session->dirty || session->append || session->inline_data || !session->nr_extents ||
+            (session_skip_unchanged && session->in_place && session->snapshot_size && session_snapshot_valid(session)))
+                return 0;
+        for (extent = session->extents; extent < session->extents + session->nr_extents; extent++)
+                if (time_before(jiffies, extent->last_access + idle))
+                        return 0;
+        if (!session->shadow) {
+                session->shadow = session_shadow_open(session);
+                if (IS_ERR(session->shadow)) {
+                        printk(KERN_INFO "SESSION SEMANTICS->Shadow file for file %s can't be created: %ld\n",session->filename,PTR_ERR(session->shadow));
+                        session->shadow = NULL;
+                        return 0;
+                }
+        }
+        segment = get_fs();
+        set_fs(KERNEL_DS);
+        ret = session_shadow_write(session, SESSION_SHADOW_BATCH, false);
+        set_fs(segment);
+        if (ret < 0) {
+                session_shadow_discard(session);
+                return 0;
+        }
+        return (unsigned long) ret;
+}
+
+/*
+ * Scan the sessions and write the idle ones into their shadow files, one batch of
+ * pages for each session, then schedule the next scan; sessions in use are
+ * skipped, as in "session_compress_scan"
+ *
+ * @work: unused
+ */
+
+void session_shadow_scan(struct work_struct *work){
+
+        /*
+         * Session used in the iteration, and the one following it
+         */
+
+        struct session *session;
+        struct session *next;
+
+        /*
+         * Number of pages written, and number of pages written into the shadow
+         * file of the current session
+         */
+
+        unsigned long written;
+        unsigned long batch;
+
+        /*
+         * True if some session has more pages to write
+         */
+
+        bool more;
+
+        /*
+         * Interval of the scans, in seconds
+         */
+
+        int secs;
+
+        secs = session_shadow_secs;
+        written = 0;
+        more = false;
+        if (secs > 0) {
+                spin_lock(&sessions_list->lock);
+                session = list_first_entry(&sessions_list->sessions_head, struct session, link_to_list);
+                while (&session->link_to_list != &sessions_list->sessions_head) {
+                        if (!mutex_trylock(&session->mutex)) {
+                                session = list_entry(session->link_to_list.next, struct session, link_to_list);
+                                continue;
+                        }
+                        spin_unlock(&sessions_list->lock);
+                        batch = session_shadow_session(session, (unsigned long) secs * HZ);
+                        written += batch;
+                        if (batch == SESSION_SHADOW_BATCH)
+                                more = true;
+                        spin_lock(&sessions_list->lock);
+                        next = list_entry(session->link_to_list.next, struct session, link_to_list);
+                        mutex_unlock(&session->mutex);
+                        session = next;
+                }
+                spin_unlock(&sessions_list->lock);
+        }
+        if (written)
+                printk(KERN_INFO "SESSION SEMANTICS->Wrote %lu idle session pages into shadow files\n", written);
+
+        /*
+         * The mutex of each session was released after its batch: if some session
+         * has more pages to write, go on after a short pause. While shadow files
+         * are disabled, check every 10 seconds if they were enabled
+         */
+
+        queue_delayed_work(session_shadow_wq, &session_shadow_work, more ? HZ / 10 + 1 : (secs > 0 ? secs : 10) * HZ);
+}
+
+/*
+ * Create the workqueue of the shadow files and start the scans of the sessions; if
+ * the workqueue can't be created, shadow files are never used
+ */
+
+void session_shadow_init(void){
+        session_shadow_wq = create_singlethread_workqueue("session_shadow");
+        if (!session_shadow_wq) {
+                printk(KERN_INFO "SESSION SEMANTICS->Workqueue not available: shadow files won't be used\n");
+                return;
+        }
+        INIT_DELAYED_WORK(&session_shadow_work, session_shadow_scan);
+        queue_delayed_work(session_shadow_wq, &session_shadow_work, 10 * HZ);
+}
+
+/*
+ * Stop the scans of the sessions and destroy their workqueue; the shadow files of
+ * the sessions still open are removed with the sessions
+ */
+
+void session_shadow_remove(void){
+        if (!session_shadow_wq)
+                return;
+        cancel_delayed_work_sync(&session_shadow_work);
+        destroy_workqueue(session_shadow_wq);
+}
+
+/*
+ * SHADOW FILE - end
+ */
+
+/*
+ * TRUNCATE SESSION BUFFER - start
+ *
+ * "ftruncate" and "fallocate" on a file in session act on the session buffer,
+ * like any other operation of the session, and they reach the original file
+ * only when the session is committed: shrinking the session releases the pages
+ * past its new end, punching a hole releases the pages inside the hole, growing
+ * the session adds a hole past its old end and allocating a range gives pages
+ * to the holes inside it
+ */
+
+/*
+ * Split a run of the session buffer in two runs, the second one starting from a
+ * given page; a compressed run is decompressed first. Nothing is done if the page
+ * is the first one of the run. The array of runs may be moved, so pointers to its
+ * elements must be looked up again (see "session_find_buffer_extent")
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ * @extent: run to be split
+ * @index: index of the first page of the second run
+ *
+ * Returns 0 if successful, -ENOMEM if not enough memory is available, or the
+ * error code returned while decompressing the run
+ */
+
+int session_split_extent(struct session *session, struct buffer_extent *extent, pgoff_t index){
+
+        /*
+         * Position of the run within the array of runs
+         */
+
+        unsigned long pos;
+
+        /*
+         * Enlarged array of runs, and its new capacity
+         */
+
+        struct buffer_extent *extents;
+        unsigned long max_extents;
+
+        /*
+         * Number of pages left in the first run
+         */
+
+        unsigned long head;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        if (index <= extent->index || index >= extent->index + extent->nr_pages)
+                return 0;
+        if (extent->compressed) {
+                ret = session_reload_extent(session, &extent);
+                if (ret)
+                        return ret;
+                extent = session_find_buffer_extent(session, index);
+                if (index == extent->index)
+                        return 0;
+        }
+
+        /*
+         * Make room in the array for the new run, right after the one being split
+         */
+
+        pos = extent - session->extents;
+        if (session->nr_extents == session->max_extents) {
+                max_extents = 2 * session->max_extents;
+                extents = krealloc(session->extents, max_extents * sizeof(struct buffer_extent), GFP_KERNEL);
+                if (!extents)
+                        return -ENOMEM;
+                session->extents = extents;
+                session->max_extents = max_extents;
+        }
+        extent = &session->extents[pos];
+        memmove(extent + 2, extent + 1, (session->nr_extents - pos - 1) * sizeof(struct buffer_extent));
+        session->nr_extents++;
+
+        /*
+         * The pages of the buffer are independent, so the second run simply starts
+         * from the descriptor and the address of its first page
+         */
+
+        head = index - extent->index;
+        extent[1] = extent[0];
+        extent[0].nr_pages = head;
+        extent[0].shadowed = min(extent[0].shadowed, head);
+        extent[1].index = index;
+        extent[1].nr_pages -= head;
+        extent[1].shadowed = extent[1].shadowed > head ? extent[1].shadowed - head : 0;
+        if (extent[1].first_page) {
+                extent[1].first_page += head;
+                extent[1].address += head << PAGE_SHIFT;
+        }
+        return 0;
+}
+
+/*
+ * Release whatever a run of the session buffer holds: its pages, its compressed
+ * content or nothing at all if it was released by the shrinker or it's a hole.
+ * The run is left without pages, and the caller decides what it becomes
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ * @extent: run to be released
+ */
+
+void session_drop_extent(struct session *session, struct buffer_extent *extent){
+        if (extent->first_page)
+                session_release_extent(extent);
+        else if (extent->compressed) {
+                atomic_long_sub(extent->nr_pages << PAGE_SHIFT, &session_compressed_bytes);
+                atomic_long_sub(extent->compressed_len, &session_compressed_size);
+                vfree(extent->compressed);
+                extent->compressed = NULL;
+                extent->compressed_len = 0;
+                session->nr_compressed -= extent->nr_pages;
+        }
+        else if (extent->hole)
+                session->nr_holes -= extent->nr_pages;
+        else
+                session->nr_evicted -= extent->nr_pages;
+}
+
+/*
+ * Turn the pages from "from" to "to" (excluded) of the session buffer into a hole,
+ * releasing them
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ * @from: index of the first page of the hole
+ * @to: index of the first page after the hole
+ *
+ * Returns 0 if successful, or the error code returned while splitting a run
+ */
+
+int session_punch_buffer(struct session *session, pgoff_t from, pgoff_t to){
+
+        /*
+         * Run of pages of the buffer used in the iteration
+         */
+
+        struct buffer_extent *extent;
+
+        /*
+         * Index of the first page of the next run to be punched
+         */
+
+        pgoff_t index;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        /*
+         * Split the runs crossing the bounds of the hole, then release the runs
+         * inside it
+         */
+
+        index = from;
+        while (index < to && (extent = session_find_buffer_extent(session, index))) {
+                ret = session_split_extent(session, extent, index);
+                if (!ret)
+                        ret = session_split_extent(session, session_find_buffer_extent(session, index), to);
+                if (ret)
+                        return ret;
+                extent = session_find_buffer_extent(session, index);
+                if (!extent->hole) {
+                        session_shadow_discard(session);
+                        session_drop_extent(session, extent);
+                        extent->hole = true;
+                        session->nr_holes += extent->nr_pages;
+                        if ((loff_t) extent->index << PAGE_SHIFT < session->snapshot_size)
+                                session->in_place = false;
+                }
+                index = extent->index + extent->nr_pages;
+        }
+        return 0;
+}
+
+/*
+ * Shrink the content of the session to "size" bytes, releasing the pages past it
+ * and clearing the rest of its last page, so that growing the session again
+ * exposes zeros
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ * @size: new number of bytes of content in the session buffer
+ *
+ * Returns 0 if successful, or the error code returned while splitting a run or
+ * loading the last page
+ */
+
+int session_shrink_buffer(struct session *session, loff_t size){
+
+        /*
+         * Number of pages of the buffer kept
+         */
+
+        pgoff_t nr_pages;
+
+        /*
+         * Last run of the buffer
+         */
+
+        struct buffer_extent *extent;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        nr_pages = (pgoff_t) ((size + PAGE_SIZE - 1) >> PAGE_SHIFT);
+        extent = session_find_buffer_extent(session, nr_pages);
+        if (extent) {
+                ret = session_split_extent(session, extent, nr_pages);
+                if (ret)
+                        return ret;
+        }
+        while (session->nr_extents) {
+                extent = &session->extents[session->nr_extents - 1];
+                if (extent->index < nr_pages)
+                        break;
+                session_drop_extent(session, extent);
+                session->nr_pages -= extent->nr_pages;
+                session->nr_extents--;
+        }
+
+        /*
+         * The pages past the new end can't be released by the shrinker anymore,
+         * since they don't hold the original content of the file
+         */
+
+        session->clean_size = min(session->clean_size, size);
+
+        /*
+         * If some of the content released is still stored in the file, the commit
+         * must rewrite the whole file
+         */
+
+        if (size < session->snapshot_size)
+                session->in_place = false;
+
+        /*
+         * The shadow file may hold content past the new end, which would be
+         * exposed by growing the session again
+         */
+
+        session_shadow_discard(session);
+        if (size & ~PAGE_MASK)
+                return session_clear_buffer(session, size, PAGE_SIZE - (size & ~PAGE_MASK));
+        return 0;
+}
+
+/*
+ * Set the size of the file in session, like "ftruncate" does
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ * @length: new size of the file
+ *
+ * Returns 0 if successful, -EINVAL if an append-only session is asked to drop the
+ * content of the original file, -ENOMEM if not enough memory is available, or the
+ * error code returned while loading a page
+ */
+
+int session_truncate(struct session *session, loff_t length){
+
+        /*
+         * Number of bytes of content in the session, before and after the change
          */
 
-        session->file->private_data=session->private;
+        loff_t content;
+        loff_t size;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        if (length < session->base)
+                return -EINVAL;
+        content = session->filesize - session->base;
+        size = length - session->base;
+        ret = 0;
+
+        /*
+         * An inline session that grows clears the new bytes, or it's moved into
+         * pages if it outgrows the inline storage; shrinking it just drops bytes
+         */
+
+        if (session->inline_data && size > content)
+                ret = session_grow_inline(session, size);
+        if (!ret && !session->inline_data) {
+                if (size < content)
+                        ret = session_shrink_buffer(session, size);
+                else if (size > content)
+                        ret = session_extend_content(session, size);
+        }
+        if (ret)
+                return ret;
+        printk(KERN_INFO "SESSION SEMANTICS->Truncated session from %lld to %lld bytes\n", session->filesize, length);
+        session->filesize = length;
+        session->dirty = true;
+        return 0;
+}
+
+/*
+ * Allocate or punch a range of the file in session, like "fallocate" does. The
+ * range is either given pages, growing the file unless FALLOC_FL_KEEP_SIZE is
+ * given, or turned into a hole if FALLOC_FL_PUNCH_HOLE is given: the pages fully
+ * inside the range are released, and the rest of the range is cleared
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ * @mode: FALLOC_FL_KEEP_SIZE, possibly together with FALLOC_FL_PUNCH_HOLE, or 0
+ * @offset: offset of the first byte of the range
+ * @len: number of bytes of the range
+ *
+ * Returns 0 if successful, -EINVAL if the range includes content of an append-only
+ * session stored in the original file, -ENOMEM if not enough memory is available,
+ * or the error code returned while loading a page
+ */
+
+int session_fallocate(struct session *session, int mode, loff_t offset, loff_t len){
+
+        /*
+         * Bounds of the range, relative to the first byte stored in the session
+         * buffer, and number of bytes of content in the session
+         */
+
+        loff_t start;
+        loff_t end;
+        loff_t content;
+
+        /*
+         * Pages fully inside the range
+         */
+
+        pgoff_t first;
+        pgoff_t last;
+
+        /*
+         * Run of pages of the buffer used in the iteration, and index of the page
+         * the iteration starts from
+         */
+
+        struct buffer_extent *extent;
+        pgoff_t index;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        if (offset < session->base)
+                return -EINVAL;
+        start = offset - session->base;
+        end = start + len;
+        content = session->filesize - session->base;
+
+        if (mode & FALLOC_FL_PUNCH_HOLE) {
+
+                /*
+                 * Only the content of the session can be punched
+                 */
+
+                end = min(end, content);
+                if (start >= end)
+                        return 0;
+                session->dirty = true;
+                if (session->inline_data) {
+                        memset(session->inline_data + start, 0, (size_t) (end - start));
+                        return 0;
+                }
+
+                /*
+                 * The pages fully inside the range become a hole; if the range
+                 * reaches the end of the session, so does its last page
+                 */
+
+                first = (pgoff_t) ((start + PAGE_SIZE - 1) >> PAGE_SHIFT);
+                last = (pgoff_t) ((end == content ? end + PAGE_SIZE - 1 : end) >> PAGE_SHIFT);
+                if (first >= last)
+                        return session_clear_buffer(session, start, end - start);
+                ret = session_clear_buffer(session, start, ((loff_t) first << PAGE_SHIFT) - start);
+                if (!ret && end > (loff_t) last << PAGE_SHIFT)
+                        ret = session_clear_buffer(session, (loff_t) last << PAGE_SHIFT, end - ((loff_t) last << PAGE_SHIFT));
+                if (!ret)
+                        ret = session_punch_buffer(session, first, last);
+                if (!ret)
+                        printk(KERN_INFO "SESSION SEMANTICS->Punched pages %lu-%lu of the session\n", first, last - 1);
+                return ret;
+        }
+
+        /*
+         * Grow the session first, unless asked not to
+         */
+
+        if (!(mode & FALLOC_FL_KEEP_SIZE) && end > content) {
+                ret = session_truncate(session, session->base + end);
+                if (ret)
+                        return ret;
+        }
+        if (session->inline_data)
+                return 0;
+
+        /*
+         * Give pages to the range: pages past the end of the buffer are added to it,
+         * while the holes and the released runs inside it are filled
+         */
+
+        last = (pgoff_t) ((end + PAGE_SIZE - 1) >> PAGE_SHIFT);
+        if (last > session->nr_pages) {
+                ret = (int) session_expand_buffer(session, (loff_t) (last - session->nr_pages) << PAGE_SHIFT, false);
+                if (ret < 0)
+                        return ret;
+        }
+        index = (pgoff_t) (start >> PAGE_SHIFT);
+        while (index < last && (extent = session_find_buffer_extent(session, index))) {
+                if (extent->hole) {
+                        ret = session_fill_hole(session, extent, index, last - 1);
+                        extent = session_find_buffer_extent(session, index);
+                }
+                else
+                        ret = session_reload_extent(session, &extent);
+                if (ret)
+                        return ret;
+                index = extent->index + extent->nr_pages;
+        }
+        printk(KERN_INFO "SESSION SEMANTICS->Allocated bytes %lld-%lld of the session\n", offset, offset + len - 1);
+        return 0;
+}
+
+/*
+ * TRUNCATE SESSION BUFFER - end
+ */
+
+/*
+ * REMOVE SESSION - start
+ *
+ * Free the buffer associated to the session, restore the original file
+ * operations in the file opened and free the session object itself.
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT; THE
+ * MUTEX IS RELEASED WITHIN THIS FUNCTION
+ */
+
+void session_remove(struct session *session) {
+
+        /*
+         * Remove the shadow file, if it was not used by the commit, then release
+         * the pages of the session buffer
+         */
+
+        session_shadow_discard(session);
+        session_free_buffer(session);
+
+        /*
+         * Restore original file operations in the opened file
+         */
+
+        session->file->f_op=session->f_ops_old;
 
         /*
-         * Release the structure with session file operations
+         * Restore the "private_data" field of the opened file
          */
 
-        kfree(session->f_ops_new);
+        session->file->private_data=session->private;
 
         /*
          * Release memory allocated to store the filename
@@ -545,7 +5094,9 @@ void session_remove(struct session *session) {
          * Remove the session object from the global list of sessions
          */
 
+        spin_lock(&sessions_list->lock);
         list_del(&session->link_to_list);
+        spin_unlock(&sessions_list->lock);
 
         /*
          * Release the mutex on the session object
@@ -577,6 +5128,7 @@ void session_remove(struct session *session) {
 void sessions_list_init(struct sessions_list *sessions) {
 
         INIT_LIST_HEAD(&(sessions->sessions_head));
+        spin_lock_init(&sessions->lock);
 }
 
 /*
@@ -584,374 +5136,613 @@ void sessions_list_init(struct sessions_list *sessions) {
  */
 
 /*
- * FILE OPERATIONS IN THE SESSION SEMANTICS - start
+ * COMMIT SESSION - start
  *
- * -> file operations to be used when a file is opened using a session semantics
+ * According to the session semantics, when a session is over all the
+ * modifications made to it using the session buffer have to be transferred
+ * to the original copy of the file itself. This happens when the last
+ * descriptor of the opened file is closed, or when the last reference to it
+ * is dropped (see "session_close" and "session_release"), and whenever the
+ * process asks for it with the ioctl command SESSION_COMMIT or with "fsync",
+ * in which case the session goes on from the content just committed. The ioctl
+ * command SESSION_ABORT does the opposite, discarding the changes of the session
+ * (see "session_abort").
  *
- * 1-session_read
- * 2-session_write
- * 3-session_llseek
- * 4-session_close
+ * Since we have to write the content of the buffer into the device
+ * the original file belongs to, we need the original "write" file
+ * operation (file-system dependent) we stored into the session object
+ * when the session was created.
+ *
+ * Anyway, first we have to truncate the original file to 0 length
+ * in order to be compliant with the session semantics: in fact this is
+ * the only way to ensure that modifications made to the original file
+ * while it was opened in the session are made visible to the other
+ * processes when the session is over, unless the file was not modified
+ * by them (see "session_flush_changes"), or the session was written into
+ * a shadow file which replaces the original file (see "session_shadow_commit")
+ *
+ * An append-only session is not truncated: its buffer only contains the
+ * bytes written past the original end of the file, so they are appended
+ * to the file with a single pass over the buffer
  */
 
 /*
- * According to the session semantics, file readings have to be redirected to the
- * buffer where the content of the original file has been copied => reading a file
- * simply means copying the requested number of bytes from the session buffer to
- * the user-space buffer, starting from the offset indicated in the session object
- *
- * In order to avoid race conditions among processes sharing the same struct file
- * associated to the opened file, a mutex has to be acquired first
+ * Let the session go on from the content just committed into the original file:
+ * the content becomes the new snapshot of the file, so the pages of the buffer
+ * are clean and hashed again, and an append-only session starts buffering the
+ * bytes past the new end of the file
  *
- * @file: pointer to the file object to be read
- * @buf: user-space buffer where the read content has to be placed
- * @size: number of bytes to read from the file
- * @offset: starting point of the read operation w.r.t to the beginning of the file;
- * this parameter corresponds to the file pointer used in usual I/O operations, so
- * we ignore it
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
  *
- * Returns number of bytes copied to given buffer, -EINVAL in case the file does
- * not contain a reference to the session object and -EIO in case not all bytes
- * requested can be read from session buffer
+ * @session: pointer to the object representing the current session
+ * @file: pointer to struct file of the opened file
  *
+ * Returns 0 if successful, -ENOMEM if the buffer of an append-only session can't
+ * be allocated again
  */
 
+int session_commit_done(struct session *session, struct file *file){
 
-ssize_t session_read(struct file *file, char __user * buf, size_t size, loff_t *offset) {
+        /*
+         * Inode of the opened file
+         */
+
+        struct inode *inode;
 
         /*
-         * Object representing the current session
+         * Run of pages of the buffer used in the iteration
          */
 
-        struct session *session;
+        struct buffer_extent *extent;
 
         /*
-         * File pointer within the current session: this is may be different from the offset
-         * received as last parameter of this function
+         * Index of a page within the current run
          */
 
-        loff_t file_pointer;
+        unsigned long i;
 
         /*
-         * Virtual address corresponding to the current offset of the opened file
+         * True if all the pages have to be hashed again
          */
 
-        void *src;
+        bool rehash;
+
+        inode = file->f_dentry->d_inode;
+        if (session->append) {
+                session_free_buffer(session);
+                session->filesize = i_size_read(inode);
+                session->base = session->filesize;
+                return session_create_buffer(session, file);
+        }
+        session->snapshot_size = session->filesize;
+        session->clean_size = session->filesize;
+        session->snapshot_mtime = inode->i_mtime;
+        session->snapshot_version = inode->i_version;
+        session->in_place = true;
+        if (session->inline_data) {
+                session->inline_hash = session_hash(session->inline_data, (size_t) session->filesize);
+                return 0;
+        }
 
         /*
-         * Index of the page in the buffer
+         * The hashes of the pages not written since the last commit still hold, so
+         * only the pages written are hashed again, unless the size of the file
+         * changed: then the array of hashes is allocated again and all the pages
+         * are hashed
          */
 
-        int index;
+        rehash = !session->hashes ||
+                session->nr_hashes != (unsigned long) ((session->filesize + PAGE_SIZE - 1) >> PAGE_SHIFT);
+        if (rehash) {
+                session_free_hashes(session);
+                session_alloc_hashes(session);
+        }
+        for (extent = session->extents; extent < session->extents + session->nr_extents; extent++) {
+
+                /*
+                 * A compressed run written since the last commit has no valid hash
+                 */
+
+                if (extent->compressed && extent->compressed_dirty) {
+                        for (i = 0; i < extent->nr_pages && extent->index + i < session->nr_hashes; i++)
+                                session->hashes[extent->index + i] = 0;
+                        extent->compressed_dirty = false;
+                }
+                if (!extent->first_page)
+                        continue;
+                for (i = 0; i < extent->nr_pages; i++) {
+                        if ((rehash || PageDirty(extent->first_page + i)) && PageUptodate(extent->first_page + i))
+                                session_hash_page(session, extent->first_page + i, extent->index + i);
+                        ClearPageDirty(extent->first_page + i);
+                }
+        }
+        return 0;
+}
+
+/*
+ * Write the content of the session into the original file, if the session was
+ * modified
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ * @file: pointer to struct file of the opened file
+ * @final: true if the session is over, so its pages can be given away (see
+ * "session_donate_page"); otherwise the session goes on from the content just
+ * committed (see "session_commit_done")
+ *
+ * Returns 0 in case of success, -EIO in case the whole buffer can't be flushed
+ * to the original file, or the error code returned while loading a page or
+ * setting the size of the file
+ */
+
+int session_commit(struct session *session, struct file *file, bool final){
 
         /*
-         * Pointer to the buffer_page object corresponding to the actual position
-         * of the session file pointer
+         * Offset in the original file from which the content of the
+         * session buffer is written
          */
 
-        struct buffer_page* current_page;
+        loff_t off;
 
         /*
-         * Return value
+         * Run of pages of the buffer used in the iteration
          */
 
-        ssize_t ret;
+        struct buffer_extent* extent;
 
         /*
-         * Bytes left to read at each iteration in case the requested size is
-         * larger than PAGE_SIZE
+         * Index of a page within the current run
          */
 
-        int left_to_read;
+        unsigned long i;
 
         /*
-         * Get the session object from the opened file
+         * True if the session was committed through its shadow file
          */
 
-        session = file->private_data;
+        bool shadowed;
 
         /*
-         * Return -EINVAL if the session object is not set
+         * Memory segment of the process
          */
 
-        if (!session) {
-                printk(KERN_INFO "SESSION SEMANTICS->session_read returned an error: %d\n", -EINVAL);
-                return -EINVAL;
+        mm_segment_t segment;
+
+        /*
+         * Return value
+         */
+
+        int ret;
+
+        /*
+         * Check the dirty flag of the session object: if dirty, modifications
+         * have to be wrtitten into the original file
+         */
+
+        if (!session->dirty)
+                return 0;
+
+        /*
+         * Since we are now going to invoke the legacy "write",
+         * that expects a buffer from the user space, we first
+         * have to mark the kernel space (where is actually the
+         * buffer given to it) as safe
+         */
+
+        segment = get_fs();
+        set_fs(KERNEL_DS);
+        session->modified = false;
+        ret = 0;
+
+        if (session_skip_unchanged && !session->append && session->in_place &&
+            session->snapshot_size && session_snapshot_valid(session)) {
+
+                /*
+                 * If the original file was not modified since the session was
+                 * opened, only the pages that changed are written into it, in place
+                 */
+
+                ret = session_flush_changes(session, file);
+        }
+        else if (session->append) {
+
+                /*
+                 * An append-only session does not truncate the original
+                 * file: the bytes in the session buffer are simply added
+                 * after its current end (the file was opened with O_APPEND,
+                 * so the legacy "write" ignores the given offset anyway)
+                 */
+
+                off = i_size_read(file->f_dentry->d_inode);
+                printk(KERN_INFO "SESSION SEMANTICS->session_commit will now append %lld bytes to file %s\n",session->filesize-session->base,session->filename);
+                ret = session_flush_buffer(session, file, off, session->filesize - session->base, final);
+        }
+        else {
+
+                /*
+                 * Pages of the buffer that were never loaded hold content of the
+                 * original file which is still stored only on the device: load
+                 * them before the file is truncated. Runs released by the shrinker
+                 * are reloaded first, while holes have nothing to load
+                 */
+
+                shadowed = false;
+                if (final && session->shadow) {
+
+                        /*
+                         * If the session has a shadow file, write what's left into
+                         * it and rename it over the original file; if that fails,
+                         * the shadow file is discarded and the file is rewritten
+                         */
+
+                        shadowed = !session_shadow_commit(session);
+                        if (!shadowed)
+                                session_shadow_discard(session);
+                }
+                for (extent = session->extents; !shadowed && !ret && extent < session->extents + session->nr_extents; extent++) {
+                        if (extent->hole)
+                                continue;
+                        ret = session_reload_extent(session, &extent);
+                        for (i = 0; !ret && i < extent->nr_pages; i++)
+                                ret = session_load_page(session, extent->first_page + i, extent->index + i, false);
+                        if (ret)
+                                printk(KERN_INFO "SESSION SEMANTICS->session_commit could not load pages from %lu\n", extent->index);
+                }
+
+                /*
+                 * Truncate file to zero length before flushing the content,
+                 * through the opened file rather than its path
+                 */
+
+                if (!shadowed && !ret) {
+                        printk(KERN_INFO "SESSION SEMANTICS->session_commit will now truncate file %s\n",session->filename);
+                        session->modified = true;
+                        ret = session_set_file_size(file, 0);
+                }
+
+                /*
+                 * The content of the session is written from the beginning of
+                 * the truncated file
+                 */
+
+                if (!shadowed && !ret)
+                        ret = session_flush_buffer(session, file, 0, session->filesize - session->base, final);
         }
 
         /*
-         * Acquire the exclusive access over the session object
+         * Restore memory segment
          */
 
-        mutex_lock(&session->mutex);
+        set_fs(segment);
 
         /*
-         * Check if the file is empty: is so, just return 0 and release
-         * mutex
+         * If the commit ending the session failed before the original file was
+         * touched, the session stays dirty and it can be committed again, e.g.
+         * when it's released. Once the file was modified, some pages of the
+         * session may have been given to it, so the session is not committed again
          */
 
-        if(!session->filesize){
-                printk(KERN_INFO "SESSION SEMANTICS->session_read read %d bytes because file is empty\n", 0);
-                mutex_unlock(&session->mutex);
-                return 0;
-        }
+        if (ret) {
+                if (final && session->modified)
+                        session->dirty = false;
+                return ret;
+        }
+        if (!final) {
+                ret = session_commit_done(session, file);
+                if (ret)
+                        return ret;
+        }
+        session->dirty = false;
+        printk(KERN_INFO "SESSION SEMANTICS->Session for file %s committed\n",session->filename);
+        return 0;
+}
+
+/*
+ * Discard the changes of the session without writing anything into the original
+ * file: the pages of the buffer are released in bulk, and the session starts again
+ * from the current content of the file, as if it was just opened. The content is
+ * not read now: the buffer is made of runs of pages released (see "struct session"),
+ * which are read again from the file as soon as they are accessed, and it fails
+ * with ESTALE if the file is modified in the meantime. The content of a small
+ * session is read into its inline storage right away, since it takes a single read,
+ * and so is the whole content if the filesystem doesn't keep the version of the
+ * inode up to date
+ *
+ * THIS HAS TO BE CALLED HOLDING THE MUTEX ON THE SESSION OBJECT
+ *
+ * @session: pointer to the object representing the current session
+ * @file: pointer to struct file of the opened file
+ *
+ * Returns 0 if successful, -ENOMEM if not enough memory is available, or the
+ * error code returned while reading the content of the file
+ */
+
+int session_abort(struct session *session, struct file *file){
 
         /*
-         * Get the file pointer of the current session
+         * Inode of the opened file
          */
 
-        file_pointer = session->position;
+        struct inode *inode;
 
         /*
-         * If the number of bytes requested to read is beyond the limit of the file,
-         * shrink the "size" parameter to the maximum possible value
+         * Run of pages of the new buffer, and number of pages of the buffer
          */
 
-        if (file_pointer + size > session->filesize) {
-                size = session->filesize - file_pointer;
-        }
+        struct buffer_extent *extent;
+        unsigned long nr_pages;
 
         /*
-         * Get the index of the page in the buffer corresponding to the session file pointer
+         * Return value
          */
 
-        index=file_pointer/PAGE_SIZE;
+        int ret;
 
-        printk(KERN_INFO "SESSION SEMANTICS->Index of first page to read:%d\n", index);
+        inode = file->f_dentry->d_inode;
+        printk(KERN_INFO "SESSION SEMANTICS->Discarding %lu pages of session for file %s\n",session->nr_pages,session->filename);
+        session_shadow_discard(session);
+        session_free_buffer(session);
+        session->dirty = false;
+        session->filesize = i_size_read(inode);
 
         /*
-         * Get the page of the buffer corresponding to the file pointer
+         * An append-only session simply starts buffering the bytes past the current
+         * end of the file
          */
 
-        list_for_each_entry(current_page,&session->pages,buffer_pages_head) {
-                if (current_page->index == index) {
-                        break;
-                }
+        if (session->append) {
+                session->base = session->filesize;
+                return session_create_buffer(session, file);
         }
 
-        printk(KERN_INFO "SESSION SEMANTICS->Index of page corresponding to file pointer:%d\n",
-               current_page->index);
-
         /*
-         * Get the exact location within the buffer from which the requested number of bytes
-         * will be read
+         * Otherwise the current content of the file becomes the new snapshot
          */
 
-        src = current_page->buffer_page_address + (file_pointer % PAGE_SIZE) * sizeof(void);
-
-        printk(KERN_INFO "SESSION SEMANTICS->Address from which read operation starts:%lu\n",src);
+        session->base = 0;
+        session->snapshot_size = session->filesize;
+        session->clean_size = session->filesize;
+        session->snapshot_mtime = inode->i_mtime;
+        session->snapshot_version = inode->i_version;
+        session->in_place = true;
+        if (session_inline_max > 0 && session->filesize <= min_t(loff_t, session_inline_max, PAGE_SIZE)) {
+                session->inline_data = kmalloc(max_t(size_t, (size_t) session->filesize, 1), GFP_KERNEL);
+                if (!session->inline_data)
+                        return -ENOMEM;
+                session->inline_size = ksize(session->inline_data);
+                return session->filesize ? session_fill_inline(session, file) : 0;
+        }
 
         /*
-         * First copy bytes from the page of the buffer corresponding to the actual position
-         * of the file pointer.
-         *
-         * If the number of bytes requested extends beyond the current page, copy all the bytes
-         * from the current page, starting from the file pointer, and then copy bytes from next
-         * page/s of the buffer, until all requested bytes have been read. Otherwise (i.e. if
-         * all the requested bytes are contained in the current page of the buffer) copy "size"
-         * bytes to the user-space buffer.
+         * Without the version of the inode, runs released now could not be told
+         * apart from content written by others later (see "session_snapshot_valid"),
+         * so the content is read at once; an empty file just gets its page
          */
 
-        if((file_pointer % PAGE_SIZE)+size>PAGE_SIZE) {
-
-                /*
-                 * Copy first bytes
-                 */
-
-                ret=copy_to_user(buf, src, PAGE_SIZE - (file_pointer % PAGE_SIZE));
-
-                /*
-                 * Check that all bytes have been copied: if not, return -EIO as error
-                 */
-
-                if(ret){
-                        printk(KERN_INFO "SESSION SEMANTICS->%d bytes could not be copied in session_read\n",
-                               ret);
-                        return -EIO;
-                }
-
-                printk(KERN_INFO "SESSION SEMANTICS->First bytes copied:%d\n",
-                       (PAGE_SIZE - (file_pointer % PAGE_SIZE)));
-
-                /*
-                 * Increment pointer in the user-space buffer
-                 */
-
-                buf = buf + (PAGE_SIZE - ((file_pointer % PAGE_SIZE))) * sizeof(void);
-
-                /*
-                 * Set the number of bytes left to read
-                 */
-
-                left_to_read = size - (PAGE_SIZE - ((file_pointer % PAGE_SIZE)));
-                printk(KERN_INFO "SESSION SEMANTICS->Bytes left to read:%d\n",left_to_read);
-
-                /*
-                 * Copy the content of buffer pages into the user-space buffer starting from
-                 * their base address until the remaining bytes have been read
-                 */
-
-                do {
-
-                        /*
-                         * Bytes copied
-                         */
-
-                        int copied;
-
-                        /*
-                         * Get current page within the buffer
-                         */
+        if (!IS_I_VERSION(inode) || !session->filesize) {
+                ret = session_create_buffer(session, file);
+                if (!ret && session->filesize)
+                        ret = session_fill_buffer(session, file);
+                return ret;
+        }
 
-                        current_page = list_entry(current_page->buffer_pages_head.next, struct buffer_page,
-                                                  buffer_pages_head);
-                        printk(KERN_INFO "SESSION SEMANTICS->Index of buffer page read now:%d\n",current_page->index);
+        /*
+         * The runs are as large as a huge page; if memory is fragmented when one
+         * of them is read again, it's split into smaller blocks of pages (see
+         * "session_reload_extent")
+         */
 
-                        /*
-                         * Check that the pointer does not point to the head of list:
-                         * if this happens instead, it means it was not possible to
-                         * copy all the requested bytes from the session buffer, then
-                         * return -EIO error
-                         */
+        session_alloc_hashes(session);
+        nr_pages = (unsigned long) ((session->filesize + PAGE_SIZE - 1) >> PAGE_SHIFT);
+        while (session->nr_pages < nr_pages) {
+                extent = session_new_buffer_extent(session, NULL, NULL);
+                if (IS_ERR(extent))
+                        return PTR_ERR(extent);
+                extent->nr_pages = min_t(unsigned long, nr_pages - session->nr_pages, 1UL << SESSION_HUGE_ORDER);
+                session->nr_pages += extent->nr_pages;
+                session->nr_evicted += extent->nr_pages;
+        }
+        return 0;
+}
 
-                        if(current_page==&session->pages){
+/*
+ * COMMIT SESSION - end
+ */
 
-                                /*
-                                 * Release the mutex over the session object
-                                 */
+/*
+ * GROUP COMMIT - start
+ *
+ * When many sessions are closed at the same time, e.g. at the end of a batch job,
+ * synchronizing each of their files on its own makes the filesystem commit its
+ * journal over and over. If "session_group_commit_ms" is set, every session whose
+ * last descriptor is closed is committed by the process closing it, as usual, then
+ * its file joins a group waiting to be synchronized with the device: the first file
+ * to join leads the group and, as long as other sessions are still being committed,
+ * waits for them for at most that number of milliseconds. Then it starts the
+ * writeback of all the files of the group before waiting for any of them, and
+ * finally synchronizes each of them: on a journaling filesystem the first "fsync"
+ * commits the journal on behalf of all the files written before, so that the
+ * following ones may find nothing left to do. The others sleep until the leader is
+ * done with their file. Closing a session in a group also makes its content durable
+ */
 
-                                mutex_unlock(&session->mutex);
+/*
+ * File waiting for the synchronization of its group
+ *
+ * link: list_head structure connecting the request to the group
+ *
+ * file: pointer to struct file of the opened file, whose session was committed
+ *
+ * ret: outcome of the synchronization
+ *
+ * done: completion signaled by the leader of the group when the file is
+ * synchronized
+ */
 
-                                /*
-                                 * Return the error code
-                                 */
+struct session_commit_request {
+        struct list_head link;
+        struct file *file;
+        int ret;
+        struct completion done;
+};
 
-                                printk(KERN_INFO "SESSION SEMANTICS->session_read returned an error: %d\n", -EIO);
-                                return -EIO;
+/*
+ * Requests of the group being collected, the spinlock protecting them, and whether
+ * the group already has a leader
+ */
 
-                        }
+LIST_HEAD(session_group);
+DEFINE_SPINLOCK(session_group_lock);
+bool session_group_led;
 
-                        /*
-                         * In case the number of bytes left to read is bigger than
-                         * PAGE_SIZE, copy PAGE_SIZE bytes from the buffer page
-                         */
+/*
+ * Number of sessions being committed which are going to join the group, and the
+ * wait queue where the leader of the group waits for it to drop to zero
+ */
 
-                        if (left_to_read > PAGE_SIZE) {
+atomic_t session_group_pending = ATOMIC_INIT(0);
+DECLARE_WAIT_QUEUE_HEAD(session_group_wait);
 
-                                /*
-                                 * Copy a page of data
-                                 */
+/*
+ * Synchronize the file of a session just committed together with the files of the
+ * other sessions closed within the same window. The caller must have incremented
+ * "session_group_pending" before committing the session
+ *
+ * @file: pointer to struct file of the opened file; the session must not be in
+ * use anymore
+ *
+ * Returns 0 if the file was synchronized with the device, or the error code
+ * returned while writing or synchronizing it
+ */
 
-                                printk(KERN_INFO "SESSION SEMANTICS->Bytes left to read:%d\n",left_to_read);
-                                copied = copy_to_user(buf, current_page->buffer_page_address, PAGE_SIZE);
-                                if (copied)
-                                        printk(KERN_INFO "SESSION SEMANTICS->%d bytes could not be copied  in session_read\n",
-                                               copied);
+int session_group_commit(struct file *file){
 
-                                /*
-                                 * Update positions in the user-space buffer
-                                 */
+        /*
+         * Request of the file, and requests used to iterate through the group
+         */
 
-                                buf = buf + (PAGE_SIZE-copied)*sizeof(void);
+        struct session_commit_request request;
+        struct session_commit_request *req;
+        struct session_commit_request *next;
 
-                                /*
-                                 * Update counter of bytes left to read
-                                 */
+        /*
+         * Requests of the group being synchronized
+         */
 
-                                left_to_read = left_to_read - (PAGE_SIZE-copied);
-                        }
-                        else {
-
-                                /*
-                                 * Copy less than a page of data
-                                 */
-                                printk(KERN_INFO "SESSION SEMANTICS->Bytes left to read:%d\n",left_to_read);
-                                copied = copy_to_user(buf, current_page->buffer_page_address, left_to_read);
-                                if (copied)
-                                        printk(KERN_INFO "SESSION SEMANTICS->%d bytes could not be copied  in session_read\n",
-                                               copied);
-                                /*
-                                 * Update positions in the user-space buffer
-                                 */
-
-                                buf = buf + (left_to_read-copied) * sizeof(void);
-
-                                /*
-                                 * If last copy was successfull, "copied" is 0 and we are done
-                                 * with reading
-                                 */
-
-                                left_to_read = copied;
-                        }
-                } while (left_to_read);
-        }
-        else{
+        LIST_HEAD(group);
 
-                /*
-                 * The current page contains all requested bytes: read them
-                 */
+        /*
+         * True if the file leads the group
+         */
 
-                if(copy_to_user(buf, src, size)){
+        bool leader;
 
-                        /*
-                         * We get here if some bytes could not be copied:
-                         * return -EIO as error code
-                         */
+        /*
+         * Number of files of the group
+         */
 
-                        printk(KERN_INFO "SESSION SEMANTICS->session_read returned an error: %d\n", -EIO);
-                        return -EIO;
+        unsigned long nr_files;
 
-                }
+        request.file = file;
+        request.ret = 0;
+        init_completion(&request.done);
+        spin_lock(&session_group_lock);
+        list_add_tail(&request.link, &session_group);
+        if (atomic_dec_and_test(&session_group_pending))
+                wake_up(&session_group_wait);
+        leader = !session_group_led;
+        session_group_led = true;
+        spin_unlock(&session_group_lock);
+        if (!leader) {
+                wait_for_completion(&request.done);
+                return request.ret;
         }
 
-
         /*
-         * Move the position of the file pointer in the session object
-         * forward by the number of bytes copied from session buffer to
-         * user-space buffer
+         * Wait while other sessions are being committed, then take the group: the
+         * files joining from now on form a new group
          */
 
-        session->position += (loff_t) size;
+        wait_event_timeout(session_group_wait, !atomic_read(&session_group_pending),
+                           msecs_to_jiffies(session_group_commit_ms));
+        spin_lock(&session_group_lock);
+        list_splice_init(&session_group, &group);
+        session_group_led = false;
+        spin_unlock(&session_group_lock);
 
         /*
-         * Release the mutex over the session object
+         * Start the writeback of all the files, then wait for it and synchronize
+         * each file: the session is clean, so only the legacy "fsync" is left (see
+         * "session_fsync")
          */
 
-        mutex_unlock(&session->mutex);
+        nr_files = 0;
+        list_for_each_entry(req, &group, link) {
+                req->ret = filemap_fdatawrite(req->file->f_mapping);
+                nr_files++;
+        }
+        list_for_each_entry(req, &group, link)
+                if (!req->ret)
+                        req->ret = filemap_fdatawait(req->file->f_mapping);
+        list_for_each_entry(req, &group, link)
+                if (!req->ret)
+                        req->ret = vfs_fsync(req->file, req->file->f_dentry, 0);
+        printk(KERN_INFO "SESSION SEMANTICS->Synchronized a group of %lu sessions\n", nr_files);
 
         /*
-         * Return the number of bytes copied
+         * Wake up the other files of the group; their requests can't be used
+         * anymore once they are woken up
          */
 
-        printk(KERN_INFO "SESSION SEMANTICS->session_read read %d bytes\n", size);
-        return size;
+        list_for_each_entry_safe(req, next, &group, link)
+                if (req != &request)
+                        complete(&req->done);
+        return request.ret;
 }
 
 /*
- * According to the session semantics, writing a file means simply copying the content of
- * the given buffer into the buffer when the opened file is stored; also the
- * file pointer of the session has to be updated.
+ * GROUP COMMIT - end
+ */
+
+/*
+ * FILE OPERATIONS IN THE SESSION SEMANTICS - start
  *
- * If the the number of bytes requested for the write operation, given the current value
- * for the file pointer, is beyond the allocated buffer, new pages have to be allocated to
- * the buffer itself and their addresses have to be stored in the session object.
+ * -> file operations to be used when a file is opened using a session semantics
+ *
+ * 1-session_read
+ * 2-session_write
+ * 3-session_llseek
+ * 4-session_close
+ * 5-session_release
+ * 6-session_fsync
+ * 7-session_ioctl
+ */
+
+/*
+ * According to the session semantics, file readings have to be redirected to the
+ * buffer where the content of the original file has been copied => reading a file
+ * simply means copying the requested number of bytes from the session buffer to
+ * the user-space buffer, starting from the offset indicated in the session object
  *
  * In order to avoid race conditions among processes sharing the same struct file
  * associated to the opened file, a mutex has to be acquired first
  *
- * @file: pointer to the file object to be written
- * @buf: user-space buffer containing content to be written
- * @size: number of bytes to write into the file
- * @offset: starting point of the write operation w.r.t to the beginning of the file;
+ * @file: pointer to the file object to be read
+ * @buf: user-space buffer where the read content has to be placed
+ * @size: number of bytes to read from the file
+ * @offset: starting point of the read operation w.r.t to the beginning of the file;
  * this parameter corresponds to the file pointer used in usual I/O operations, so
  * we ignore it
  *
- * Returns number of bytes written into the buffer associated to the opened file,
- * -EINVAL in case the file does not contain a reference to the session object and
- * -EIO in case not all bytes requested can be read from session buffer
+ * Returns number of bytes copied to given buffer, -EINVAL in case the file does
+ * not contain a reference to the session object and -EIO in case not all bytes
+ * requested can be read from session buffer
+ *
  */
 
-ssize_t session_write(struct file *file, const char __user *buf, size_t size, loff_t *offset) {
+
+ssize_t session_read(struct file *file, char __user * buf, size_t size, loff_t *offset) {
 
         /*
          * Object representing the current session
@@ -967,32 +5758,7 @@ ssize_t session_write(struct file *file, const char __user *buf, size_t size, lo
         loff_t file_pointer;
 
         /*
-         * Virtual address corresponding to the current offset of the opened file
-         */
-
-        void *dest;
-
-        /*
-         * Index of the page in the buffer
-         */
-
-        int index;
-
-        /*
-         * Pointer to the buffer_page structure associated to the current page
-         * within the buffer
-         */
-
-        struct buffer_page* current_page;
-
-        /*
-         * Bytes left to write in the loop in case the size is larger than PAGE_SIZE
-         */
-
-        int left_to_write;
-
-        /*
-         * Return value;
+         * Return value
          */
 
         ssize_t ret;
@@ -1008,278 +5774,278 @@ ssize_t session_write(struct file *file, const char __user *buf, size_t size, lo
          */
 
         if (!session) {
-                printk(KERN_INFO "SESSION SEMANTICS->session_write returned an error: %d\n", -EINVAL);
+                printk(KERN_INFO "SESSION SEMANTICS->session_read returned an error: %d\n", -EINVAL);
                 return -EINVAL;
         }
 
         /*
-         * Check if the number of bytes to write is positive: if not, return 0
-         */
-
-        if(!size){
-                printk(KERN_INFO "WARNING: SESSION SEMANTICS->session_write: requested 0 bytes to read\n");
-                printk(KERN_INFO "SESSION SEMANTICS->session_write wrote %d bytes\n",0);
-                return 0;
-        }
-
-        /*
-         * Acquire the mutex over the session object
+         * Acquire the exclusive access over the session object
          */
 
         mutex_lock(&session->mutex);
 
         /*
-         * Get the value of the file pointer for the current session
+         * Get the file pointer of the current session
          */
 
         file_pointer = session->position;
 
         /*
-         * Get the index of the page in the buffer corresponding to the session file pointer
-         */
-
-        index=file_pointer/PAGE_SIZE;
-        printk(KERN_INFO "SESSION SEMANTICS->Index of first page to write:%d\n", index);
-
-        /*
-         * Get the page of the buffer corresponding to the file pointer
+         * Check if there's nothing left to read: is so, just return 0 and release
+         * mutex
          */
 
-        list_for_each_entry(current_page,&session->pages,buffer_pages_head) {
-                if (current_page->index == index) {
-                        break;
-                }
+        if(file_pointer >= session->filesize || !size){
+                printk(KERN_INFO "SESSION SEMANTICS->session_read read %d bytes because of end of file\n", 0);
+                mutex_unlock(&session->mutex);
+                return 0;
         }
 
-        printk(KERN_INFO "SESSION SEMANTICS->Index of page corresponding to file pointer:%d\nBase address:%lu",
-               current_page->index,current_page->buffer_page_address);
-
         /*
-         * Get the exact location within the buffer from which the requested number of bytes
-         * will be written
+         * If the number of bytes requested to read is beyond the limit of the file,
+         * shrink the "size" parameter to the maximum possible value
          */
 
-        dest = current_page->buffer_page_address + (file_pointer % PAGE_SIZE) * sizeof(void);
-
-        printk(KERN_INFO "SESSION SEMANTICS->Address from which write operation starts:%lu\n", dest);
+        if (file_pointer + size > session->filesize) {
+                size = session->filesize - file_pointer;
+        }
 
         /*
-         * If the requested size is bigger than the actual size of the session buffer, new pages have
-         * to be allocated in order to satisfy the user request. Because of this, writing takes two
-         * steps:
-         *
-         * 1- expand the session buffer allocating new pages in case bytes written go beyond the limit
-         * of the session buffer
-         *
-         * 2- copy bytes from the user-space buffer to the session buffer until all the pages of the
-         * latter have been modified
-         *
-         * As regard with the second step, we adopt the same strategy used for "session_read", i.e the
-         * page of the buffer corresponding to the file pointer is filled starting from a possibly
-         * non-zero offset, and then the rest of the pages are written starting from their base address
+         * In an append-only session the bytes before "base" were never copied into
+         * the session buffer, so they are read from the original file using the
+         * legacy "read" operation. The read stops at "base", so that the bytes
+         * written during the session are returned by the next read
          */
 
-        if((file_pointer % PAGE_SIZE)+size>PAGE_SIZE) {
+        if (file_pointer < session->base) {
 
                 /*
-                 * Bytes that could not be copied
+                 * Offset of the read operation within the original file
                  */
 
-                int failed;
-
-                /*
-                 * Return value from function to expand the session buffer
-                 */
+                loff_t off = file_pointer;
 
-                int expand_buffer;
+                if (file_pointer + size > session->base)
+                        size = session->base - file_pointer;
+                ret = session->f_ops_old->read(file, buf, size, &off);
 
                 /*
-                 * Copy first bytes
+                 * Move the session file pointer forward by the number of bytes
+                 * actually read, then release the mutex
                  */
 
-                failed=copy_from_user(dest, buf, PAGE_SIZE - ((file_pointer % PAGE_SIZE)));
-
-                /*
-                 * Check that all bytes could be copied: if not, return -EIO error
-                 */
+                if (ret > 0)
+                        session->position += (loff_t) ret;
+                mutex_unlock(&session->mutex);
+                printk(KERN_INFO "SESSION SEMANTICS->session_read read %zd bytes from the original file\n", ret);
+                return ret;
+        }
 
-                if(failed){
-                        printk(KERN_INFO "SESSION SEMANTICS->%d bytes could not be copied in session_write\n",
-                               ret);
-                        return -EIO;
-                }
+        /*
+         * Copy the requested bytes from the session buffer to the user-space buffer;
+         * the offset within the buffer is relative to its first byte
+         */
 
-                /*
-                 * Copy was successful
-                 */
+        ret = session_copy_buffer(session, file_pointer - session->base, buf, size, false);
+        if (ret) {
+                mutex_unlock(&session->mutex);
+                printk(KERN_INFO "SESSION SEMANTICS->session_read returned an error: %zd\n", ret);
+                return ret;
+        }
 
-                printk(KERN_INFO "SESSION SEMANTICS->Number of bytes written to fill the page:%d\n",
-                       PAGE_SIZE - ((file_pointer % PAGE_SIZE)));
+        /*
+         * Move the position of the file pointer in the session object
+         * forward by the number of bytes copied from session buffer to
+         * user-space buffer
+         */
 
-                /*
-                 * Increment pointer in the user-space buffer
-                 */
+        session->position += (loff_t) size;
 
-                buf = buf + (PAGE_SIZE - ((file_pointer % PAGE_SIZE))) * sizeof(void);
+        /*
+         * Release the mutex over the session object
+         */
 
-                /*
-                 * Set the number of bytes left to write
-                 */
+        mutex_unlock(&session->mutex);
 
-                left_to_write = size - (PAGE_SIZE - ((file_pointer % PAGE_SIZE)));
+        /*
+         * Return the number of bytes copied
+         */
 
-                /*
-                 * We filled the page containing the file pointer with first bytes
-                 * from the user-space buffer => increment the index variable
-                 */
+        printk(KERN_INFO "SESSION SEMANTICS->session_read read %zu bytes\n", size);
+        return size;
+}
 
-                ++index;
+/*
+ * According to the session semantics, writing a file means simply copying the content of
+ * the given buffer into the buffer when the opened file is stored; also the
+ * file pointer of the session has to be updated.
+ *
+ * If the the number of bytes requested for the write operation, given the current value
+ * for the file pointer, is beyond the allocated buffer, new pages have to be allocated to
+ * the buffer itself and their addresses have to be stored in the session object.
+ *
+ * In order to avoid race conditions among processes sharing the same struct file
+ * associated to the opened file, a mutex has to be acquired first
+ *
+ * @file: pointer to the file object to be written
+ * @buf: user-space buffer containing content to be written
+ * @size: number of bytes to write into the file
+ * @offset: starting point of the write operation w.r.t to the beginning of the file;
+ * this parameter corresponds to the file pointer used in usual I/O operations, so
+ * we ignore it
+ *
+ * Returns number of bytes written into the buffer associated to the opened file,
+ * -EINVAL in case the file does not contain a reference to the session object and
+ * -EIO in case not all bytes requested can be read from session buffer
+ */
 
-                /*
-                 * If the left bytes go beyond the actual boundary of the file, expand
-                 * the buffer with a proper number of pages before start copying data
-                 * from user-space to session buffer
-                 */
+ssize_t session_write(struct file *file, const char __user *buf, size_t size, loff_t *offset) {
 
-                if(left_to_write/PAGE_SIZE+1>session->nr_pages-index) {
+        /*
+         * Object representing the current session
+         */
 
-                        /*
-                         * Expand the buffer
-                         */
+        struct session *session;
 
-                        expand_buffer = session_expand_buffer(session, left_to_write);
+        /*
+         * File pointer within the current session, relative to the first byte stored
+         * in the session buffer: this is may be different from the offset received as
+         * last parameter of this function
+         */
 
-                        /*
-                         * Check the return value: if positive, the buffer has been expanded
-                         * successfully and we update the number of pages in the buffer, while
-                         * if it's negative something went wrong so we stop and return error
-                         * code
-                         */
+        loff_t file_pointer;
 
-                        if(expand_buffer>=0)
-                                session->nr_pages+=expand_buffer;
-                        else {
-                                printk(KERN_INFO "SESSION SEMANTICS->Could not expand the buffer because of error:%d\n",expand_buffer);
-                                mutex_unlock(&session->mutex);
-                                return expand_buffer;
-                        }
-                        printk(KERN_INFO "SESSION SEMANTICS->Expanded buffer: now there are %d pages\n",session->nr_pages);
-                }
+        /*
+         * Number of pages of the buffer needed to complete the write operation
+         */
 
-                /*
-                 * Copy the content of buffer pages into the user-space buffer starting from
-                 * their base address until the remaining bytes have been read
-                 */
+        unsigned long needed_pages;
 
-                do {
+        /*
+         * Number of bytes of content in the session before the write
+         */
 
-                        /*
-                         * Bytes copied
-                         */
+        loff_t content;
 
-                        int copied;
+        /*
+         * Return value;
+         */
 
-                        /*
-                         * Get current page within the buffer
-                         */
+        ssize_t ret;
 
-                        current_page = list_entry(current_page->buffer_pages_head.next, struct buffer_page,
-                                                  buffer_pages_head);
-                        printk(KERN_INFO "SESSION SEMANTICS->Index of current page to write:%d\n", current_page->index);
+        /*
+         * Get the session object from the opened file
+         */
 
-                        /*
-                         * Check that the pointer does not point to the head of list:
-                         * if this happens instead, it means that we need more pages
-                         * for the session buffer because the size of bytes to be
-                         * written goes beyond the limit of the session buffer.
-                         *
-                         * If this is the case, it means that some pages could not be
-                         * copied from the user-space buffer in previous iteration
-                         * => return -EIO error code
-                         */
+        session = file->private_data;
 
-                        if(current_page==&session->pages){
-                                printk(KERN_INFO "SESSION SEMANTICS->Some bytes could not be copied in session_write\n");
-                                return -EIO;
-                        }
+        /*
+         * Return -EINVAL if the session object is not set
+         */
 
-                        /*
-                         * In case the number of bytes left to write is bigger than
-                         * PAGE_SIZE, copy PAGE_SIZE bytes into the buffer page
-                         */
+        if (!session) {
+                printk(KERN_INFO "SESSION SEMANTICS->session_write returned an error: %d\n", -EINVAL);
+                return -EINVAL;
+        }
 
-                        printk(KERN_INFO "SESSION SEMANTICS->Bytes left to write:%d\n", left_to_write);
-                        if (left_to_write > PAGE_SIZE) {
+        /*
+         * Check if the number of bytes to write is positive: if not, return 0
+         */
 
-                                /*
-                                 * Copy a page of data
-                                 */
+        if(!size){
+                printk(KERN_INFO "WARNING: SESSION SEMANTICS->session_write: requested 0 bytes to read\n");
+                printk(KERN_INFO "SESSION SEMANTICS->session_write wrote %d bytes\n",0);
+                return 0;
+        }
 
-                                copied = copy_from_user(current_page->buffer_page_address,buf, PAGE_SIZE);
+        /*
+         * Acquire the mutex over the session object
+         */
 
-                                /*
-                                 * Update positions in the user-space buffer
-                                 */
+        mutex_lock(&session->mutex);
 
-                                buf = buf + (PAGE_SIZE-copied) * sizeof(void);
+        /*
+         * In an append-only session every write takes place at the end of the
+         * file, as it happens for files opened with O_APPEND
+         */
 
-                                /*
-                                 * Update counter of bytes left to write
-                                 */
+        if (session->append)
+                session->position = session->filesize;
 
-                                left_to_write = left_to_write - (PAGE_SIZE-copied);
-                        }
-                        else {
+        /*
+         * Get the value of the file pointer for the current session, relative
+         * to the first byte stored in the session buffer
+         */
 
-                                /*
-                                 * Copy less than a page of data
-                                 */
+        file_pointer = session->position - session->base;
 
-                                copied = copy_from_user(current_page->buffer_page_address,buf,left_to_write);
+        /*
+         * If the bytes written go beyond the limit of the session buffer, new pages
+         * have to be allocated in order to satisfy the user request before copying
+         * data from user-space to session buffer
+         */
 
-                                /*
-                                 * Update positions in the user-space buffer
-                                 */
+        if (session->inline_data) {
 
-                                buf = buf + (left_to_write-copied) * sizeof(void);
+                /*
+                 * A small session keeps its content inline: make room for the
+                 * bytes written, moving the content into pages if needed
+                 */
 
-                                /*
-                                 * If all bytes were successfully written, "copied" is
-                                 * equal to 0, so we exit the loop
-                                 */
+                ret = session_grow_inline(session, file_pointer + (loff_t) size);
+                if (ret < 0) {
+                        printk(KERN_INFO "SESSION SEMANTICS->Could not expand the buffer because of error:%zd\n",ret);
+                        mutex_unlock(&session->mutex);
+                        return ret;
+                }
+        }
 
-                                left_to_write = copied;
-                        }
-                } while (left_to_write);
+        /*
+         * A write past the end of the session leaves a gap behind it, which is
+         * filled with zeros in the pages already in the buffer and becomes a hole
+         * past them (an inline session is cleared by "session_grow_inline")
+         */
 
-                /*
-                 * After expanding the session buffer, all requested bytes have been copied from
-                 * user-space buffer into session buffer
-                 */
+        content = session->filesize - session->base;
+        if (!session->inline_data && file_pointer > content) {
+                ret = session_extend_content(session, file_pointer);
+                if (ret < 0) {
+                        printk(KERN_INFO "SESSION SEMANTICS->Could not expand the buffer because of error:%zd\n",ret);
+                        mutex_unlock(&session->mutex);
+                        return ret;
+                }
         }
-        else{
+        needed_pages = (unsigned long) ((file_pointer + size + PAGE_SIZE - 1) >> PAGE_SHIFT);
+        if (!session->inline_data && needed_pages > session->nr_pages) {
 
                 /*
-                 * The current page suffices to copy all requested bytes
+                 * Expand the buffer
                  */
 
-                ret=copy_from_user(dest, buf, size);
+                ret = session_expand_buffer(session, (loff_t) (needed_pages - session->nr_pages) << PAGE_SHIFT, true);
 
                 /*
-                 * Check if all bytes could be copied into session buffer: if not,
-                 * return -EIO error
+                 * Check the return value: if negative something went wrong so we stop
+                 * and return error code (the number of pages in the buffer is updated
+                 * by "session_expand_buffer")
                  */
 
-                if(ret){
+                if (ret < 0) {
+                        printk(KERN_INFO "SESSION SEMANTICS->Could not expand the buffer because of error:%zd\n",ret);
+                        mutex_unlock(&session->mutex);
+                        return ret;
+                }
+        }
 
-                        /*
-                         * We get here if some bytes could not be copied:
-                         * return -EIO
-                         */
+        /*
+         * Copy the bytes from the user-space buffer into the session buffer
+         */
 
-                        printk(KERN_INFO "SESSION SEMANTICS->Some bytes could not be copied in session_write\n");
-                        return -EIO;
-                }
+        ret = session_copy_buffer(session, file_pointer, (char __user *) buf, size, true);
+        if (ret) {
+                mutex_unlock(&session->mutex);
+                printk(KERN_INFO "SESSION SEMANTICS->session_write returned an error: %zd\n", ret);
+                return ret;
         }
 
         /*
@@ -1300,7 +6066,7 @@ ssize_t session_write(struct file *file, const char __user *buf, size_t size, lo
 
         if (session->position > session->filesize){
                 session->filesize += (session->position-session->filesize);
-                printk(KERN_INFO "SESSION SEMANTICS->session_write increased filesize to:%d\n",session->filesize);
+                printk(KERN_INFO "SESSION SEMANTICS->session_write increased filesize to:%lld\n",session->filesize);
         }
 
         /*
@@ -1321,7 +6087,7 @@ ssize_t session_write(struct file *file, const char __user *buf, size_t size, lo
          * Return the number of bytes copied
          */
 
-        printk(KERN_INFO "SESSION SEMANTICS->session_write wrote %d bytes\n",size);
+        printk(KERN_INFO "SESSION SEMANTICS->session_write wrote %zu bytes\n",size);
         return size;
 }
 
@@ -1338,15 +6104,18 @@ ssize_t session_write(struct file *file, const char __user *buf, size_t size, lo
  * @origin: position within the session buffer from which the shift has to take place;
  * values for this parameter have to be interpreted as with regular lseek, namely
  *
- * NOTE: FILE HOLES ARE NOT ALLOWED -> it is possible to set the session file pointer only
- * within the boundaries of actual size of the file
+ * NOTE: the session file pointer can be moved past the end of the file: a write there
+ * leaves a hole between the end of the file and the written bytes
  *
  * SEEK_SET: origin coincides with the beginning of the buffer
  * SEEK_CUR: origin coincides with the current values of the session file pointer
  * SEEK_END: origin coincides with the last byte of the buffer
+ * SEEK_DATA: the file pointer is moved to the first byte of data at or after "offset"
+ * SEEK_HOLE: the file pointer is moved to the first hole at or after "offset"
  *
- * Returns the new value for the session file pointer or -EINVAL in case the
- * requested parameters are not compatible with the buffer associated to the session
+ * Returns the new value for the session file pointer, -EINVAL in case the requested
+ * parameters are not compatible with the buffer associated to the session or -ENXIO
+ * if SEEK_DATA or SEEK_HOLE start past the end of the file (or there's no more data)
  */
 
 loff_t session_llseek(struct file *file, loff_t offset, int origin) {
@@ -1375,7 +6144,7 @@ loff_t session_llseek(struct file *file, loff_t offset, int origin) {
          * Index of the page in the buffer
          */
 
-        int index;
+        pgoff_t index;
 
         /*
          * Get the session object from the opened file
@@ -1414,19 +6183,21 @@ loff_t session_llseek(struct file *file, loff_t offset, int origin) {
          * Set the new value for the file pointer depending on the provided flag for
          * the "origin" parameter
          */
-        printk(KERN_INFO "SESSION SEMANTICS->Current position of session file pointer:%d\n",session->position);
-        printk(KERN_INFO "SESSION SEMANTICS->Current filesize:%d\n",session->filesize);
+        printk(KERN_INFO "SESSION SEMANTICS->Current position of session file pointer:%lld\n",session->position);
+        printk(KERN_INFO "SESSION SEMANTICS->Current filesize:%lld\n",session->filesize);
         switch (origin) {
                 case SEEK_END: {
 
                         printk(KERN_INFO "SESSION SEMANTICS->Seeking session from first byte after end of buffer\n");
 
                         /*
-                         * Return -EINVAL if the new requested position for the file pointer is beyond the actual
-                         * limits of the opened file; also release mutex on session object
+                         * Return -EINVAL if the new requested position for the file pointer is before the
+                         * beginning of the file or beyond the maximum size of a file; also release mutex on
+                         * session object. Moving past the end of the file is allowed: a write there leaves a
+                         * hole behind it
                          */
 
-                        if ((offset > 0) || (offset <= -(session->filesize))) {
+                        if (session->filesize + offset < 0 || session->filesize + offset > file->f_dentry->d_inode->i_sb->s_maxbytes) {
                                 printk(KERN_INFO "SESSION SEMANTICS->session_llseek returned an error: %d\n", -EINVAL);
                                 mutex_unlock(&session->mutex);
                                 return -EINVAL;
@@ -1444,11 +6215,12 @@ loff_t session_llseek(struct file *file, loff_t offset, int origin) {
                         printk(KERN_INFO "SESSION SEMANTICS->Seeking session from current position in the buffer\n");
 
                         /*
-                         * Return -EINVAL if the new requested position for the file pointer is beyond the actual
-                         * limits of the opened file; also release mutex on session object
+                         * Return -EINVAL if the new requested position for the file pointer is before the
+                         * beginning of the file or beyond the maximum size of a file; also release mutex on
+                         * session object
                          */
 
-                        if ((file_pointer + offset > session->filesize) || (file_pointer + offset < 0)) {
+                        if ((file_pointer + offset > file->f_dentry->d_inode->i_sb->s_maxbytes) || (file_pointer + offset < 0)) {
                                 printk(KERN_INFO "SESSION SEMANTICS->session_llseek returned an error: %d\n", -EINVAL);
                                 mutex_unlock(&session->mutex);
                                 return -EINVAL;
@@ -1466,11 +6238,12 @@ loff_t session_llseek(struct file *file, loff_t offset, int origin) {
                         printk(KERN_INFO "SESSION SEMANTICS->Seeking session from first byte of buffer\n");
 
                         /*
-                         * Return -EINVAL if the new requested position for the file pointer is beyond the actual
-                         * limits of the opened file; also release mutex on session object
+                         * Return -EINVAL if the new requested position for the file pointer is before the
+                         * beginning of the file or beyond the maximum size of a file; also release mutex on
+                         * session object
                          */
 
-                        if ((offset < 0) || (offset >= session->filesize)) {
+                        if ((offset < 0) || (offset > file->f_dentry->d_inode->i_sb->s_maxbytes)) {
                                 printk(KERN_INFO "SESSION SEMANTICS->session_llseek returned an error: %d\n", -EINVAL);
                                 mutex_unlock(&session->mutex);
                                 return -EINVAL;
@@ -1484,6 +6257,39 @@ loff_t session_llseek(struct file *file, loff_t offset, int origin) {
                         session->position = offset;
                         break;
                 }
+                case SEEK_DATA:
+                case SEEK_HOLE: {
+
+                        printk(KERN_INFO "SESSION SEMANTICS->Seeking session to next %s\n", origin == SEEK_DATA ? "data" : "hole");
+
+                        /*
+                         * Look for the next data or hole in the runs of the buffer: return -ENXIO if there's
+                         * none, or -EINVAL if the offset is negative; also release mutex on session object
+                         */
+
+                        file_pointer = offset < 0 ? -EINVAL : session_seek_hole(session, offset, origin == SEEK_HOLE);
+                        if (file_pointer < 0) {
+                                printk(KERN_INFO "SESSION SEMANTICS->session_llseek returned an error: %lld\n", file_pointer);
+                                mutex_unlock(&session->mutex);
+                                return file_pointer;
+                        }
+
+                        /*
+                         * File pointer now points to the data or hole found
+                         */
+
+                        session->position = file_pointer;
+                        break;
+                }
+                default: {
+
+                        /*
+                         * Unknown origin: return -EINVAL and release mutex on session object
+                         */
+
+                        mutex_unlock(&session->mutex);
+                        return -EINVAL;
+                }
         }
 
         /*
@@ -1496,41 +6302,24 @@ loff_t session_llseek(struct file *file, loff_t offset, int origin) {
          * Return the new value of the file pointer
          */
 
-        printk(KERN_INFO "SESSION SEMANTICS->session_llseek set new position to: %d\n", session->position);
+        printk(KERN_INFO "SESSION SEMANTICS->session_llseek set new position to: %lld\n", session->position);
         return session->position;
 }
 
 /*
- * According to the session semantics, when an opened file has to
- * be closed, all the modifications made to it using the session
- * buffer have to be transferred to the original copy of the file
- * itself.
- *
- * In order to do that, we set the function pointer to the "flush"
- * operation: in fact, this is invoked by the regular system call
- * "close" so it can be exploited to flush the content of the buffer
- *
- * Since we have to write the content of the buffer into the device
- * the original file belongs to, we need the original "write" file
- * operation (file-system dependent) we stored into the session object
- * when the session was created.
- *
- * Anyway, first we have to truncate the original file to 0 length
- * in order to be compliant with the session semantics: in fact this is
- * the only way to ensure that modifications made to the original file
- * while it was opened in the session are made visible to the other
- * processes when the session is over.
- * The system call "sys_truncate" is used to truncate the file
+ * When a descriptor of a file in session is closed, the VFS invokes the "flush"
+ * operation, whatever the number of descriptors sharing the opened file: after
+ * a "fork" or a "dup", closing one of them must not commit the session while the
+ * others still use it. The session is committed only when the last descriptor
+ * is closed, i.e. when the opened file has no other reference, so that the error
+ * of the commit, if any, is returned by "close"
  *
- * @file: pointer to struct file of the opened file whose session has to
- * be flushed
+ * @file: pointer to struct file of the opened file
  * id: pointer to struct files_struct of the opened file; we ignore this
  * parameter
  *
  * Returns 0 in case of success, -EINVAL is the the session object is not
- * valid and -EIO in case the whole buffer can't be flushed to the original
- * file. Moreover, in case the system call "sys_truncate" fails, its error
- * code is returned.
+ * valid, or the error code returned by the commit (see "session_commit")
  */
 
 int session_close(struct file *file, fl_owner_t id) {
@@ -1541,25 +6330,12 @@ int session_close(struct file *file, fl_owner_t id) {
 
         struct session *session;
 
-        /*
-         * Virtual address corresponding to the current offset of the opened
-         * file
-         */
-
-        void *src;
-
         /*
          * Return value
          */
 
         int ret;
 
-        /*
-         * Memory segment of the process
-         */
-
-        mm_segment_t segment;
-
         /*
          * Get the session object from the opened file
          */
@@ -1575,300 +6351,255 @@ int session_close(struct file *file, fl_owner_t id) {
                 return -EINVAL;
         }
 
-        /*
-         * Set the return value to 0, indicating success: this is the value
-         * returned in case no I/O session has to be flushed, otherwise the
-         * return value may change
-         */
-
-        ret = 0;
-
         /*
          * Acquire the mutex over the session object: in this way we can be sure
          * that any other conflicting session operation is finished
          */
 
         mutex_lock(&session->mutex);
-
-        /*
-         * Check the dirty flag of the session object: if dirty, modifications
-         * have to be wrtitten into the original file
-         */
-
-        if (session->dirty) {
-
-                /*
-                 * Next page from the buffer to be flushed into the original file
-                 */
-
-                struct buffer_page* current_page;
-
-                /*
-                 * Index used to iterate through pages of the session buffer
-                 */
-
-                int i;
-
-                /*
-                 * Current file pointer in the session buffer
-                 */
-
-                loff_t off=0;
-
-                /*
-                 * Pointer to the session buffer
-                 */
-
-                void *buffer;
-
-                /*
-                 * Bytes to be flushed into the original file
-                 */
-
-                size_t filesize;
-
-                /*
-                 * Since we are now going to invoke two system calls
-                 * (write and truncate) that expect a buffer from the
-                 * user space, we first have to mark the kernel space
-                 * (where is actually the buffer given to them) as safe
-                 */
-
-                segment = get_fs();
-                set_fs(KERNEL_DS);
-
-                /*
-                 * Truncate file to zero length before flushing the content
-                 */
-
-                printk(KERN_INFO "SESSION SEMANTICS->session_close will now truncate file %s\n",session->filename);
-                ret = truncate_call(session->filename, 0);
-
-                /*
-                 * Return error code if truncate fails; before the
-                 * session has to be removed, the module usage
-                 * counter has to be decreased and the original
-                 * memory segment has to be set
-                 */
-
-                if(ret) {
-                        set_fs(segment);
-                        session_remove(session);
-                        module_put(THIS_MODULE);
-                        printk(KERN_INFO "SESSION SEMANTICS->session_close could not truncate file and returned error: %d\n", ret);
-                        return ret;
-                }
-
-                /*
-                 * Initialize parameters for the write operation from the session
-                 * object and the struct file of the opened file
-                 */
-
-                filesize = session->filesize;
-                off = file->f_pos;
-
-                /*
-                 * Initialize "current_page" to the first element of the list of
-                 * pages of the session
-                 */
-
-                current_page=list_entry(session->pages.next,struct buffer_page,buffer_pages_head);
-                printk(KERN_INFO "SESSION SEMANTICS->session_close will now flush buffer page %d with base address %lu\nOffset:%lld",current_page->index,current_page->buffer_page_address,off);
+        ret = 0;
+        if (file_count(file) == 1 && session->dirty && session_group_commit_ms > 0) {
 
                 /*
-                 * Set appropriate memory segment.
+                 * Last descriptor of a modified session: commit it now, then
+                 * synchronize its file together with the other sessions being
+                 * closed. A failed commit is handled as when the session is not
+                 * in a group
                  */
 
-                set_fs(KERNEL_DS);
+                atomic_inc(&session_group_pending);
+                ret = session_commit(session, file, true);
+                mutex_unlock(&session->mutex);
+                if (!ret)
+                        ret = session_group_commit(file);
+                else if (atomic_dec_and_test(&session_group_pending))
+                        wake_up(&session_group_wait);
+                if (ret)
+                        printk(KERN_INFO "SESSION SEMANTICS->session_close could not commit the session and returned error: %d\n", ret);
+                return ret;
+        }
+        if (file_count(file) == 1) {
 
                 /*
-                 * Do differentiated work depending on the number of pages in the
-                 * buffer
+                 * Last descriptor: commit the session now. If the commit fails
+                 * before the original file is modified, the session stays dirty
+                 * and it's committed again when it's released (see
+                 * "session_commit")
                  */
 
-                printk(KERN_INFO "SESSION SEMANTICS->Number of pages:%d\n",session->nr_pages);
-                if(session->nr_pages>1) {
-
-                        /*
-                         * Write first page of the buffer; note that file pointer of the original
-                         * file gets updated so that next write will occur after last written byte
-                         */
-
-                        ret = session->f_ops_old->write(file, current_page->buffer_page_address, PAGE_SIZE,
-                                                       &off);
-
-                        /*
-                         * If the number of bytes flushed to the original file is less
-                         * than the size of the buffer, return -EIO (I/O error); first
-                         * release the session, decrement the module usage counter and
-                         * restore previous memory segment
-                         */
-
-                        if (ret < PAGE_SIZE) {
-                                ret = -EIO;
-                                set_fs(segment);
-                                session_remove(session);
-                                module_put(THIS_MODULE);
-                                printk(KERN_INFO "SESSION SEMANTICS->session_close could not write all bytes because of error: %d\n", ret);
-                                return ret;
-                        }
-
-                        /*
-                         * Decrease filesize
-                         */
-
-                        filesize-=PAGE_SIZE;
-
-                        /*
-                         * Flush content of every remaining single page of the buffer into the original
-                         * file
-                         *
-                         * In the following loop we write PAGE_SIZE bytes
-                         */
-
-                        for (i = 0; i < session->nr_pages-2; i++) {
+                ret = session_commit(session, file, true);
+                if (ret)
+                        printk(KERN_INFO "SESSION SEMANTICS->session_close could not commit the session and returned error: %d\n", ret);
+        }
+        mutex_unlock(&session->mutex);
+        return ret;
+}
 
-                                /*
-                                 * Get current page within the buffer
-                                 */
+/*
+ * When the last reference to a file in session is dropped, the VFS invokes the
+ * "release" operation: the session is committed, unless this was already done
+ * when its last descriptor was closed (see "session_close"), then it's removed,
+ * restoring the legacy file operations, and the legacy "release" is invoked
+ *
+ * @inode: inode of the opened file
+ * @file: pointer to struct file of the opened file
+ *
+ * Returns the value returned by the legacy "release", 0 if there's none and
+ * -EINVAL if the file does not contain a reference to the session object; the
+ * VFS ignores it anyway
+ */
 
-                                current_page = list_entry(current_page->buffer_pages_head.next, struct buffer_page,
-                                                          buffer_pages_head);
-                                printk(KERN_INFO "SESSION SEMANTICS->session_close will now flush buffer page %d\nOffset:%lld\n",current_page->index,off);
+int session_release(struct inode *inode, struct file *file) {
 
-                                /*
-                                 * Write content of the page into the file
-                                 */
+        /*
+         * Object representing the current session
+         */
 
-                                ret = session->f_ops_old->write(file, current_page->buffer_page_address, PAGE_SIZE,
-                                                                &off);
+        struct session *session;
 
-                                /*
-                                 * If the number of bytes flushed to the original file is less
-                                 * than the size of the buffer, return -EIO (I/O error)
-                                 */
+        /*
+         * Legacy "release" operation
+         */
 
-                                if (ret < PAGE_SIZE) {
-                                        ret = -EIO;
-                                        set_fs(segment);
-                                        session_remove(session);
-                                        module_put(THIS_MODULE);
-                                        printk(KERN_INFO "SESSION SEMANTICS->session_close could not write all bytes because of error: %d\n", ret);
-                                        return ret;
-                                }
+        int (*release)(struct inode *, struct file *);
 
-                                /*
-                                 * Decrease filesize
-                                 */
+        /*
+         * Return value
+         */
 
-                                filesize-=PAGE_SIZE;
+        int ret;
 
-                        }
+        session = file->private_data;
+        if (!session)
+                return -EINVAL;
+        mutex_lock(&session->mutex);
+        ret = session_commit(session, file, true);
+        if (ret)
+                printk(KERN_INFO "SESSION SEMANTICS->session_release could not commit the session because of error: %d\n", ret);
 
-                        printk(KERN_INFO "SESSION SEMANTICS->session_close will now flush remaning bytes:%d",filesize);
+        /*
+         * Remove the session object and its associated data structures; this
+         * restores the legacy file operations and releases the mutex
+         */
 
-                        /*
-                         * Now we write last bytes (possibly less than PAGE_SIZE) into file
-                         */
+        release = session->f_ops_old->release;
+        session_remove(session);
+        ret = release ? release(inode, file) : 0;
 
-                        current_page = list_entry(current_page->buffer_pages_head.next, struct buffer_page,
-                                                  buffer_pages_head);
-                        printk(KERN_INFO "SESSION SEMANTICS->session_close will now flush buffer page %d\nBytes to copy:%d\nOffset:%lld",current_page->index,filesize%PAGE_SIZE,off);
+        /*
+         * Before returning decrement the module usage counter
+         */
 
-                        /*
-                         * Copy remaining bytes
-                         */
+        printk(KERN_INFO "SESSION SEMANTICS->Decrementing module usage counter\n");
+        module_put(THIS_MODULE);
+        return ret;
+}
 
-                        if(filesize%PAGE_SIZE) {
-                                ret = session->f_ops_old->write(file, current_page->buffer_page_address,
-                                                                filesize % PAGE_SIZE, &off);
+/*
+ * Synchronizing a file in session with its device checkpoints the session: the
+ * session is committed without ending it (see "session_commit"), which writes
+ * only the pages written since the previous checkpoint as long as the original
+ * file was not modified in the meantime, then the legacy "fsync" operation, if
+ * any, makes the content written durable. The session buffer is kept, and the
+ * session goes on from the content just committed.
+ *
+ * The VFS invokes "fsync" holding the mutex of the inode, which is needed by the
+ * commit: it's released while the session is committed, and the pages written
+ * by the commit are sent to the device before it's taken again
+ *
+ * @file: pointer to struct file of the opened file
+ * @dentry: dentry of the opened file
+ * @datasync: true if only the data of the file has to be synchronized
+ *
+ * Returns the value returned by the legacy "fsync", 0 if there's none, the error
+ * code returned by the commit, or -EINVAL if the file does not contain a reference
+ * to the session object
+ */
 
-                                /*
-                                 * Check that all bytes were written
-                                 */
+int session_fsync(struct file *file, struct dentry *dentry, int datasync) {
 
-                                if (ret < filesize%PAGE_SIZE) {
-                                        ret = -EIO;
-                                        set_fs(segment);
-                                        session_remove(session);
-                                        module_put(THIS_MODULE);
-                                        printk(KERN_INFO "SESSION SEMANTICS->session_close could not write all bytes because of error: %d\n", ret);
-                                        return ret;
-                                }
-                        }
-                        else {
-                                ret = session->f_ops_old->write(file, current_page->buffer_page_address, PAGE_SIZE,
-                                                                &off);
-
-                                /*
-                                 * Check that all bytes were written
-                                 */
-
-                                if (ret < PAGE_SIZE) {
-                                        ret = -EIO;
-                                        set_fs(segment);
-                                        session_remove(session);
-                                        module_put(THIS_MODULE);
-                                        printk(KERN_INFO "SESSION SEMANTICS->session_close could not write all bytes because of error: %d\n", ret);
-                                        return ret;
-                                }
-                        }
-                }
-                else {
+        /*
+         * Object representing the current session
+         */
 
-                        /*
-                         * Copy content of the only page
-                         */
+        struct session *session;
 
-                        ret = session->f_ops_old->write(file, current_page->buffer_page_address, filesize % PAGE_SIZE,
-                                                        &off);
+        /*
+         * Inode of the opened file
+         */
 
-                        /*
-                         * Check that all bytes were written
-                         */
+        struct inode *inode;
 
-                        if (ret < filesize%PAGE_SIZE) {
-                                ret = -EIO;
-                                set_fs(segment);
-                                session_remove(session);
-                                module_put(THIS_MODULE);
-                                printk(KERN_INFO "SESSION SEMANTICS->session_close could not write all bytes because of error: %d\n", ret);
-                                return ret;
-                        }
-                }
+        /*
+         * Return value
+         */
 
-                /*
-                 * Restore memory segment
-                 */
+        int ret;
 
-                set_fs(segment);
+        session = file->private_data;
+        if (!session)
+                return -EINVAL;
+        inode = dentry->d_inode;
+        mutex_unlock(&inode->i_mutex);
+        mutex_lock(&session->mutex);
+        ret = session_commit(session, file, false);
+        mutex_unlock(&session->mutex);
+        if (!ret)
+                ret = filemap_write_and_wait(file->f_mapping);
+        mutex_lock(&inode->i_mutex);
+        if (ret) {
+                printk(KERN_INFO "SESSION SEMANTICS->session_fsync could not checkpoint the session because of error: %d\n", ret);
+                return ret;
         }
+        if (!session->f_ops_old->fsync)
+                return 0;
+        return session->f_ops_old->fsync(file, dentry, datasync);
+}
 
-        /*
-         * Unlock the session
-         */
+/*
+ * The ioctl command SESSION_COMMIT commits the session right away, without ending
+ * it (see "session_commit"), while SESSION_ABORT discards its changes (see
+ * "session_abort"); the other ioctl commands of a file in session are handled by
+ * the legacy "unlocked_ioctl" operation or, if there's none, by the legacy "ioctl"
+ * holding the big kernel lock, as the VFS would do for the original file
+ *
+ * @file: pointer to struct file of the opened file
+ * @cmd: ioctl command
+ * @arg: argument of the command
+ *
+ * Returns the outcome of the command for SESSION_COMMIT and SESSION_ABORT, otherwise
+ * the value returned by the legacy operation, -ENOTTY if there's none; -EINVAL if
+ * the file does not contain a reference to the session object
+ */
 
-        //mutex_unlock(&session->mutex);
+long session_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
 
         /*
-         * Remove the session object and its associated data structures
+         * Object representing the current session
          */
 
-        session_remove(session);
+        struct session *session;
 
         /*
-         * Before returning decrement the module usage counter
+         * Return value
          */
 
-        printk(KERN_INFO "SESSION SEMANTICS->Decrementing module usage counter\n");
-        module_put(THIS_MODULE);
+        int ret;
+
+        session = file->private_data;
+        if (!session)
+                return -EINVAL;
+        if (cmd == SESSION_COMMIT || cmd == SESSION_ABORT) {
+                mutex_lock(&session->mutex);
+                if (cmd == SESSION_COMMIT)
+                        ret = session_commit(session, file, false);
+                else
+                        ret = session_abort(session, file);
+                mutex_unlock(&session->mutex);
+                return ret;
+        }
+        if (session->f_ops_old->unlocked_ioctl)
+                return session->f_ops_old->unlocked_ioctl(file, cmd, arg);
+        if (!session->f_ops_old->ioctl)
+                return -ENOTTY;
+        lock_kernel();
+        ret = session->f_ops_old->ioctl(file->f_dentry->d_inode, file, cmd, arg);
+        unlock_kernel();
+        return ret;
+}
+
+/*
+ * A 32-bit process on a 64-bit kernel issues its ioctl commands through
+ * "compat_ioctl": SESSION_COMMIT and SESSION_ABORT take no argument, so they are
+ * handled as usual (see "session_ioctl"), while the other commands are handled
+ * by the legacy "compat_ioctl" operation, if any, otherwise they are left to the
+ * generic compat code of the VFS, which converts them and ends up in "session_ioctl"
+ *
+ * @file: pointer to struct file of the opened file
+ * @cmd: ioctl command
+ * @arg: argument of the command
+ *
+ * Returns the outcome of the command, -ENOIOCTLCMD if it has to be converted by
+ * the VFS, or -EINVAL if the file does not contain a reference to the session
+ * object
+ */
+
+long session_compat_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
 
         /*
-         * Return outcome of the function
+         * Object representing the current session
          */
 
-        printk(KERN_INFO "SESSION SEMANTICS->session_close returned value: %d\n", 0);
-        return 0;
+        struct session *session;
+
+        session = file->private_data;
+        if (!session)
+                return -EINVAL;
+        if (cmd == SESSION_COMMIT || cmd == SESSION_ABORT)
+                return session_ioctl(file, cmd, arg);
+        if (!session->f_ops_old->compat_ioctl)
+                return -ENOIOCTLCMD;
+        return session->f_ops_old->compat_ioctl(file, cmd, arg);
 }
 
 /*
@@ -1878,29 +6609,19 @@ int session_close(struct file *file, fl_owner_t id) {
 /*
  * SESSION INIT - start
  *
- * Set the initial buffer used by the session to the pages filled with the content of the
- * file and initialize its mutex semaphore
+ * Initialize the fields of the session object and its mutex semaphore; the
+ * session buffer is initially empty (see "session_create_buffer")
  *
  * @session: session object to be initialized
- * @va: virtual address of the contiguous address space to be used as initial buffer of
- * the session
  * @filename: kernel-space filename of the opened file
- * @order: 2^order pages have been allocated to the inital buffer
- * @firstpage: pointer to the descriptor of the first among the frames allocated as initial
- * buffer
  * @filesize: number of bytes in the opened file
+ * @append: true if the session is append-only, in which case the buffer does not
+ * contain the original content of the file
  *
- * Returns 0 in case of success, -ENOMEM if not enough memory is available for the
- * creation of the new objects and -EINVAL if any of the given pointer is NULL
+ * Returns 0 in case of success
  */
 
-int session_init(struct session *session, void *va, const char *filename, int order,struct page* firstpage,loff_t filesize) {
-
-        /*
-         * Index value used in the pages loop (see below)
-         */
-
-        int i;
+int session_init(struct session *session, const char *filename, loff_t filesize, bool append) {
 
         printk(KERN_INFO "SESSION SEMANTICS->Initialising session\n");
 
@@ -1921,6 +6642,7 @@ int session_init(struct session *session, void *va, const char *filename, int or
          */
 
         session->dirty = false;
+        session->modified = false;
 
         /*
          * Set the file length in the session object
@@ -1928,6 +6650,14 @@ int session_init(struct session *session, void *va, const char *filename, int or
 
         session->filesize = filesize;
 
+        /*
+         * An append-only session buffers only the bytes past the current end of
+         * the file, otherwise the buffer starts from the first byte of the file
+         */
+
+        session->append = append;
+        session->base = append ? filesize : 0;
+
         /*
          * Store the filename into the session
          */
@@ -1935,57 +6665,68 @@ int session_init(struct session *session, void *va, const char *filename, int or
         session->filename=filename;
 
         /*
-         * Store the number of pages in the initial buffer
+         * The buffer has no pages yet
          */
 
-        session->nr_pages = (1 << order);
+        session->nr_pages = 0;
+        session->nr_evicted = 0;
+        session->nr_compressed = 0;
+        session->nr_holes = 0;
 
         /*
-         * Initialize the link to the list of sessions
+         * Unless the session is append-only, the buffer starts with the content of
+         * the file, whose pages can be released and read again while the file is
+         * not modified; the modification time and version of the file are set by
+         * the caller
          */
 
-        INIT_LIST_HEAD(&(session->link_to_list));
+        session->snapshot_size = append ? 0 : filesize;
+        session->clean_size = session->snapshot_size;
 
         /*
-         * Initialize the the list of pages
+         * No page was hashed yet, and the commit may write only the pages that
+         * changed (see "session_flush_changes")
          */
 
-        INIT_LIST_HEAD(&(session->pages));
+        session->hashes = NULL;
+        session->nr_hashes = 0;
+        session->inline_hash = 0;
+        session->in_place = true;
 
         /*
-         * Store address of the descriptor and virtual address of the pages allocated
-         * for the initial buffer into the session object
+         * The session has no shadow file yet
          */
 
-        for(i=0;i<session->nr_pages;i++){
+        session->shadow = NULL;
 
-                /*
-                 * Pointer to the new buffer_page object
-                 */
+        /*
+         * The buffer is allocated on the NUMA node of the CPU opening the session,
+         * which is also the first node used when the buffer is interleaved
+         */
 
-                struct buffer_page* buffer_page;
+        session->node = numa_node_id();
+        session->next_node = session->node;
 
-                /*
-                 * Create a new "buffer_page" object for each page of the buffer
-                 */
+        /*
+         * Initialize the link to the list of sessions
+         */
 
-                buffer_page=session_new_buffer_page(va+i*PAGE_SIZE,firstpage+i,i);
+        INIT_LIST_HEAD(&(session->link_to_list));
 
-                /*
-                 * Check if the creation of the new object was successful: if not,
-                 * return the associated error code
-                 */
+        /*
+         * The array of runs of pages is initially empty
+         */
 
-                if(IS_ERR_VALUE(PTR_ERR(buffer_page)))
-                        return PTR_ERR(buffer_page);
-                /*
-                 * Add the newly created object to the corresponding list in the session
-                 * object
-                 */
+        session->extents = NULL;
+        session->nr_extents = 0;
+        session->max_extents = 0;
 
-                printk(KERN_INFO "SESSION SEMANTICS->Adding buffer page %lu to session\n",buffer_page);
-                list_add_tail(&buffer_page->buffer_pages_head,&(session->pages));
-        }
+        /*
+         * The session does not use inline storage yet
+         */
+
+        session->inline_data = NULL;
+        session->inline_size = 0;
 
         /*
          * Initialization of the session object was successful: return 0
@@ -2002,28 +6743,38 @@ int session_init(struct session *session, void *va, const char *filename, int or
 /*
  * SESSION OPERATIONS INSTALL - start
  *
- * Define a new structure for file operations, inherit all the function
- * pointers from the given file except for the read, write and llseek
- * operations, which are instead initialized to their version specific
- * for the session semantics. Former function pointers have to be saved
- * because they have to be used to flush the content of the buffer into
- * the original file when the session is closed.
+ * All the files opened adopting the session semantics share the following
+ * table of file operations. The operations which are not defined here are
+ * handled by the generic code of the VFS: vectored reads and writes and
+ * splicing go through "session_read" and "session_write", while mapping the
+ * file in memory is not allowed, since it would bypass the session buffer
+ */
+
+const struct file_operations session_file_operations = {
+        .read = session_read,
+        .write = session_write,
+        .llseek = session_llseek,
+        .flush = session_close,
+        .release = session_release,
+        .fsync = session_fsync,
+        .unlocked_ioctl = session_ioctl,
+        .compat_ioctl = session_compat_ioctl,
+};
+
+/*
+ * Install the table of file operations for the session semantics into the
+ * opened file. The former table has to be saved because its "write" is used
+ * to flush the content of the buffer into the original file when the session
+ * is closed, and it's restored when the session is over.
  *
  * @file: pointer to file struct of the file opened adopting a session semantics
  * @session: pointer to the current session object
  *
- * Returns 0 in case of success, -ENOMEM in case not enough memory is available
- * to allocate the new file operations
+ * Returns 0
  */
 
 int session_install_operations(struct file *file, struct session *session) {
 
-        /*
-         * Pointer to new structure for file operations
-         */
-
-        struct file_operations *f_ops;
-
         /*
          * Save function pointers to the original file operations into the
          * session object: they will be restored when the session is over
@@ -2032,47 +6783,10 @@ int session_install_operations(struct file *file, struct session *session) {
         session->f_ops_old = file->f_op;
 
         /*
-         * Allocate memory for the new file operations structure
-         */
-
-        f_ops = kmalloc(sizeof(struct file_operations), GFP_KERNEL);
-
-        /*
-         * Check if memory is available to allocate the new file operations
-         */
-
-        if(!f_ops)
-                return -ENOMEM;
-
-        /*
-         * Inherit file operations
-         */
-
-        *f_ops = *file->f_op;
-
-        /*
-         * Change pointer for read,write, llseek and flush
-         */
-
-        f_ops->read = session_read;
-        f_ops->write = session_write;
-        f_ops->llseek = session_llseek;
-        f_ops->flush=session_close;
-
-        /*
-         * Install the new structure for file operations
-         */
-
-        file->f_op = (const struct file_operations *) f_ops;
-
-        /*
-         * Store the pointer to the new structure in the session
-         * object in order to easily restore original operations
-         * when the session is over and also in order to release
-         * allocates memory
+         * Install the shared table of file operations
          */
 
-        session->f_ops_new=f_ops;
+        file->f_op = &session_file_operations;
 
         /*
          * File operations successfully installed: return 0
@@ -2094,8 +6808,8 @@ int session_install_operations(struct file *file, struct session *session) {
  * address of the session object.
  *
  * The structure with pointer to file operations is costant, so we can
- * not modify it, but rather we have to define a new one with the same
- * function pointers except for read,write and llseek
+ * not modify it, but rather we have to replace it with the one shared by
+ * all the sessions
  *
  * @file: pointer to the struct file of the file involved in the session
  * @session: pointer to the session object
@@ -2145,7 +6859,9 @@ int session_install(struct file *file, struct session *session) {
          * opened sessions
          */
 
+        spin_lock(&sessions_list->lock);
         list_add(&session->link_to_list, &sessions_list->sessions_head);
+        spin_unlock(&sessions_list->lock);
 
         /*
          * New session has been successfully installed: return 0
@@ -2240,13 +6956,6 @@ int session_open(int fd,const char __user *filename, int flags, int mode){
 
         int ret;
 
-        /*
-         * Pointer to the descriptor of the first page in the buffer allocated to
-         * read the file
-         */
-
-        struct page *first_page;
-
         /*
          * File object of the opened file
          */
@@ -2261,24 +6970,29 @@ int session_open(int fd,const char __user *filename, int flags, int mode){
         struct session *session;
 
         /*
-         * Virtual address of the buffer into which the file is stored while
-         * a session is open
+         * Size of the file to be opened
+         */
+
+        loff_t filesize;
+
+        /*
+         * Whether the session is append-only
          */
 
-        void *va;
+        bool append;
 
         /*
-         * Order of pages to be requested to the function "alloc_pages" in order
-         * to store the content of the opened file
+         * Whether the original content of the file is discarded (O_TRUNC)
          */
 
-        int order;
+        bool truncate;
 
         /*
-         * Size of the file to be opened
+         * Whether the original content of the file is copied into the session
+         * buffer only when it's actually needed
          */
 
-        loff_t filesize;
+        bool lazy;
 
         /*
          * Get the file object corresponding to the opened file
@@ -2290,38 +7004,37 @@ int session_open(int fd,const char __user *filename, int flags, int mode){
          * Get the size of the opened file
          */
 
-        filesize = opened_file->f_dentry->d_inode->i_size;
+        filesize = i_size_read(opened_file->f_dentry->d_inode);
 
         /*
-         * ALLOCATE SESSION BUFFER
-         *
-         * Allocate the initial buffer associated to the current session
-         *
-         * The size is such that the whole file can be copied into it: 2^order
-         * pages are allocated; if the file is empty, only one pages is allocated
-         *
-         * The pointer to the descriptor of the first page in the buffer is returned
-         * and the order variable is set
+         * A session opened with O_APPEND is append-only: the original content of
+         * the file is never copied into the session buffer
          */
 
-        first_page=session_create_buffer(filesize,filename,&order);
+        append = (flags & O_APPEND) != 0;
 
-        /* Check that the pages have been successfully allocated:
-         * return -ENOMEM in case not enough memory is available
-         * for them
+        /*
+         * A session opened with O_TRUNC starts from an empty buffer: the original
+         * content of the file will be discarded when the session is closed (see
+         * "sys_session_open"), so there's no reason to read it. This also overrides
+         * the append-only mode
          */
 
-        if (!first_page) {
-                ret = -ENOMEM;
-                printk(KERN_INFO "System call sys_session_open returned this error value:%d\n", ret);
-                return ret;
+        truncate = (flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY;
+        if (truncate) {
+                filesize = 0;
+                append = false;
         }
 
         /*
-         * Map pages of the buffer into virtual address space
+         * A write-only session can't read the file, so its pages are loaded only
+         * when a partial write or the commit requires their original content. This
+         * needs the version of the inode, to check that the file was not modified
+         * in the meantime (see "session_load_page"): on the other filesystems the
+         * content is copied right away, as for any other session
          */
 
-        va = kmap(first_page);
+        lazy = (flags & O_ACCMODE) == O_WRONLY && IS_I_VERSION(opened_file->f_dentry->d_inode);
 
         /*
          * Allocate a new session object
@@ -2332,12 +7045,11 @@ int session_open(int fd,const char __user *filename, int flags, int mode){
         /*
          * Check that the session object has  been successfully
          * allocated: return -ENOMEM in case not enough memory
-         * is available and release allocated pages
+         * is available
          */
 
         if (!session) {
                 ret = -ENOMEM;
-                __free_pages(first_page, order);
                 printk(KERN_INFO "System call sys_session_open returned this error value:%d\n", ret);
                 return ret;
         }
@@ -2354,12 +7066,11 @@ int session_open(int fd,const char __user *filename, int flags, int mode){
 
         /*
          * Check enough memory is available: if not, release the session
-         * object,release allocated pages and return -ENOMEM
+         * object and return -ENOMEM
          */
 
         if(!kernel_filename){
                 ret = -ENOMEM;
-                __free_pages(first_page, order);
                 kfree(session);
                 printk(KERN_INFO "System call sys_session_open returned this error value:%d\n", ret);
                 return ret;
@@ -2375,7 +7086,9 @@ int session_open(int fd,const char __user *filename, int flags, int mode){
          * Initialise the session object
          */
 
-        ret=session_init(session, va, kernel_filename, order,first_page,filesize);
+        ret=session_init(session, kernel_filename, filesize, append);
+        session->snapshot_mtime = opened_file->f_dentry->d_inode->i_mtime;
+        session->snapshot_version = opened_file->f_dentry->d_inode->i_version;
 
         /*
          * Check if the initialization of the session object: if not, free
@@ -2383,12 +7096,6 @@ int session_open(int fd,const char __user *filename, int flags, int mode){
          */
 
         if(ret){
-                struct buffer_page* buffer_page;
-                struct buffer_page* temp;
-                list_for_each_entry_safe(buffer_page,temp,&session->pages,buffer_pages_head){
-                        kfree(buffer_page);
-                }
-                __free_pages(first_page, order);
                 kfree(session);
                 kfree(kernel_filename);
                 printk(KERN_INFO "System call sys_session_open returned this error value:%d\n", ret);
@@ -2396,23 +7103,56 @@ int session_open(int fd,const char __user *filename, int flags, int mode){
         }
 
         /*
-         * Save private data of the opened file (if any)
+         * ALLOCATE SESSION BUFFER
+         *
+         * Allocate the initial buffer associated to the current session
+         *
+         * The size is such that the whole file can be copied into it; if the
+         * file is empty or the session is append-only, only one pages is
+         * allocated
          */
 
-        if(opened_file->private_data) {
-                session->private=opened_file->private_data;
+        ret=session_create_buffer(session, opened_file);
+
+        /* Check that the pages have been successfully allocated:
+         * return -ENOMEM in case not enough memory is available
+         * for them and release allocated memory
+         */
+
+        if (ret) {
+                session_free_buffer(session);
+                kfree(session);
+                kfree(kernel_filename);
+                printk(KERN_INFO "System call sys_session_open returned this error value:%d\n", ret);
+                return ret;
         }
 
+        /*
+         * The truncation of the file has to be propagated to the original file
+         * when the session is closed, even if nothing is written
+         */
+
+        if (truncate)
+                session->dirty = true;
+
+        /*
+         * Save private data of the opened file (if any)
+         */
+
+        session->private=opened_file->private_data;
+
         /*
          * INITIALIZE SESSION OBJECT - end
          */
 
         /*
-         * If the file is not empty, copy its content into the allocated
-         * session buffer
+         * If the file is not empty and the session is neither append-only nor
+         * write-only, copy its content into the allocated session buffer; the
+         * content of a small session is always copied, since it takes a single
+         * read
          */
 
-        if(filesize) {
+        if(filesize && !append && (!lazy || session->inline_data)) {
 
                 /*
                  * COPY FILE INTO SESSION BUFFER - start
@@ -2423,7 +7163,10 @@ int session_open(int fd,const char __user *filename, int flags, int mode){
                  * until a number of bytes equal to the filesize has been transferred
                  */
 
-                ret=session_fill_buffer(first_page,order,opened_file);
+                if (session->inline_data)
+                        ret=session_fill_inline(session,opened_file);
+                else
+                        ret=session_fill_buffer(session,opened_file);
 
                 /*
                  * The function returns 0 when the request is successfully submitted:
@@ -2432,12 +7175,7 @@ int session_open(int fd,const char __user *filename, int flags, int mode){
                  */
 
                 if (ret) {
-                        struct buffer_page* buffer_page;
-                        struct buffer_page* temp;
-                        list_for_each_entry_safe(buffer_page,temp,&session->pages,buffer_pages_head){
-                                kfree(buffer_page);
-                        }
-                        __free_pages(first_page, order);
+                        session_free_buffer(session);
                         kfree(session);
                         kfree(kernel_filename);
                         ret = -EIO;
@@ -2463,12 +7201,7 @@ int session_open(int fd,const char __user *filename, int flags, int mode){
          */
 
         if(ret) {
-                struct buffer_page *buffer_page;
-                struct buffer_page *temp;
-                list_for_each_entry_safe(buffer_page, temp, &session->pages, buffer_pages_head) {
-                        kfree(buffer_page);
-                }
-                __free_pages(first_page, order);
+                session_free_buffer(session);
                 kfree(session);
                 kfree(kernel_filename);
                 ret = -EIO;
@@ -2536,15 +7269,29 @@ asmlinkage long sys_session_open(const char __user *filename, int flags, int mod
 
         int fd;
 
+        /*
+         * Flags given to the original system call
+         */
+
+        int open_flags;
+
         /*
          * Open file using the original sys_open system call ignoring the flag
-         * used to request the session semantics (for the time being)
+         * used to request the session semantics (for the time being).
+         *
+         * The truncation requested by O_TRUNC is part of the session, so it
+         * must not be visible to other processes before the session is closed:
+         * the flag is not given to the original system call and it's handled
+         * by "session_open" instead
          */
 
         if (flags & SESSION_OPEN) {
-                fd = previous_open(filename, flags & ~SESSION_OPEN, mode);
+                open_flags = flags & ~SESSION_OPEN;
+                if ((flags & O_ACCMODE) != O_RDONLY)
+                        open_flags &= ~O_TRUNC;
+                fd = previous_open(filename, open_flags, mode);
                 printk(KERN_INFO "SESSION SEMANTICS->Flags for filename \"%s\": %d; file descriptor:%d\n", filename,
-                       flags & ~SESSION_OPEN, fd);
+                       open_flags, fd);
         }
         else {
                 fd = previous_open(filename, flags, mode);
@@ -2583,3 +7330,130 @@ asmlinkage long sys_session_open(const char __user *filename, int flags, int mod
 
         return fd;
 }
+
+/*
+ * SYS_FTRUNCATE AND SYS_FALLOCATE WITH SESSION SEMANTICS SUPPORT
+ *
+ * These are the system calls we replace "ftruncate" and "fallocate" with: if the
+ * given file descriptor refers to a file in session, the operation is applied to
+ * the session buffer (see "session_truncate" and "session_fallocate") and it will
+ * reach the original file when the session is closed; otherwise the original
+ * system call is invoked
+ */
+
+/*
+ * @fd: file descriptor of the file to be truncated
+ * @length: new size of the file
+ *
+ * Returns 0 if successful, -EBADF if the file descriptor is not valid, -EINVAL if
+ * the file is not opened for writing or the length is not valid, -EFBIG if the
+ * length exceeds the maximum size of a file, or the error code returned while
+ * truncating the session
+ */
+
+asmlinkage long sys_session_ftruncate(unsigned int fd, unsigned long length) {
+
+        /*
+         * Opened file
+         */
+
+        struct file *file;
+
+        /*
+         * Object representing the session
+         */
+
+        struct session *session;
+
+        /*
+         * Return value
+         */
+
+        long ret;
+
+        file = fget(fd);
+        if (!file)
+                return -EBADF;
+        if (file->f_op != &session_file_operations) {
+                fput(file);
+                return previous_ftruncate(fd, length);
+        }
+        session = file->private_data;
+        if (!(file->f_mode & FMODE_WRITE) || (long) length < 0)
+                ret = -EINVAL;
+        else if ((loff_t) length > file->f_dentry->d_inode->i_sb->s_maxbytes)
+                ret = -EFBIG;
+        else {
+                mutex_lock(&session->mutex);
+                ret = session_truncate(session, (loff_t) length);
+                mutex_unlock(&session->mutex);
+        }
+        fput(file);
+        printk(KERN_INFO "SESSION SEMANTICS->sys_session_ftruncate returned value: %ld\n", ret);
+        return ret;
+}
+
+/*
+ * @fd: file descriptor of the file
+ * @mode: FALLOC_FL_KEEP_SIZE, possibly together with FALLOC_FL_PUNCH_HOLE, or 0
+ * @offset: offset of the first byte of the range to be allocated or punched
+ * @len: number of bytes of the range
+ *
+ * Returns 0 if successful, -EBADF if the file descriptor is not valid or the file
+ * is not opened for writing, -EINVAL if the range is not valid, -EOPNOTSUPP if the
+ * mode is not supported, -EFBIG if the range exceeds the maximum size of a file,
+ * or the error code returned while changing the session
+ */
+
+asmlinkage long sys_session_fallocate(int fd, int mode, loff_t offset, loff_t len) {
+
+        /*
+         * Opened file
+         */
+
+        struct file *file;
+
+        /*
+         * Object representing the session
+         */
+
+        struct session *session;
+
+        /*
+         * Return value
+         */
+
+        long ret;
+
+        file = fget(fd);
+        if (!file)
+                return -EBADF;
+        if (file->f_op != &session_file_operations) {
+                fput(file);
+                return previous_fallocate(fd, mode, offset, len);
+        }
+        session = file->private_data;
+
+        /*
+         * Check the arguments as the original system call does; a hole can only be
+         * punched keeping the size of the file
+         */
+
+        if (!(file->f_mode & FMODE_WRITE))
+                ret = -EBADF;
+        else if (offset < 0 || len <= 0)
+                ret = -EINVAL;
+        else if ((mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE)) ||
+                 ((mode & FALLOC_FL_PUNCH_HOLE) && !(mode & FALLOC_FL_KEEP_SIZE)))
+                ret = -EOPNOTSUPP;
+        else if (offset + len > file->f_dentry->d_inode->i_sb->s_maxbytes || offset + len < 0)
+                ret = -EFBIG;
+        else {
+                mutex_lock(&session->mutex);
+                ret = session_fallocate(session, mode, offset, len);
+                mutex_unlock(&session->mutex);
+        }
+        fput(file);
+        printk(KERN_INFO "SESSION SEMANTICS->sys_session_fallocate returned value: %ld\n", ret);
+        return ret;
+}
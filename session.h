@@ -4,11 +4,58 @@
 /*
  * When a process wants to start an I/O session relative to a certain file,
  * the following flag has to be bitwise-ORed with the other flags given in
- * the open system call
+ * the open system call. If O_APPEND is given too, the session is append-only
+ * (see "struct session")
  */
 
 #define SESSION_OPEN 00000004
 
+/*
+ * ioctl command committing a session without closing it: the content of the
+ * session is written into the original file as if the session was closed, then
+ * the session goes on from that content. Otherwise a session is committed when
+ * the last descriptor referring to it is closed, so descriptors duplicated by
+ * "dup" or inherited through "fork" don't commit it
+ */
+
+#define SESSION_COMMIT _IO('S', 1)
+
+/*
+ * ioctl command discarding the changes of a session: nothing is written into the
+ * original file, and the session starts again from its current content
+ */
+
+#define SESSION_ABORT _IO('S', 2)
+
+/*
+ * Values of the parameter "origin" of lseek that move the file pointer to the
+ * next byte of data or to the next hole of a session, if the headers do not
+ * define them yet
+ */
+
+#ifndef SEEK_DATA
+#define SEEK_DATA 3
+#endif
+#ifndef SEEK_HOLE
+#define SEEK_HOLE 4
+#endif
+
+/*
+ * Flag of fallocate asking to turn a range of the file into a hole, if the kernel
+ * headers do not define it yet
+ */
+
+#ifndef FALLOC_FL_PUNCH_HOLE
+#define FALLOC_FL_PUNCH_HOLE 0x02
+#endif
+
+/*
+ * Order of the largest blocks of pages the session buffer is made of, i.e.
+ * blocks of 2 MB
+ */
+
+#define SESSION_HUGE_ORDER (21 - PAGE_SHIFT)
+
 /*
  * Pointer to the object that tracks all the file sessions active in the
  * system
@@ -19,8 +66,6 @@ extern struct sessions_list* sessions_list;
 /*
  * Structure to handle an I/O session on a file
  *
- * order: the buffer session is made of 1<<order pages
- *
  * mutex: semaphore to be used to synchronize read and write operations on the
  * file during a session; a spinlock can't be used because the functions used
  * to copy data to and from the session inside the critical sections may put
@@ -31,26 +76,88 @@ extern struct sessions_list* sessions_list;
  *
  * filesize: number of bytes in the file
  *
+ * base: offset within the file of the first byte stored in the session buffer;
+ * this is 0 unless the session is append-only, in which case it's the size of
+ * the file when the session was opened
+ *
+ * append: indicates that the session is append-only, i.e. the buffer only
+ * stores the bytes beyond "base" and they are appended to the original file
+ * when the session is closed
+ *
  * f_ops_old: pointer to the structure containing pointers to original file operations
  * of an opened file; the legacy "write" operations is used to flush content of
  * the session when this is over and all the legacy operations are restored when
  * the session is removed
  *
- * f_ops_new: pointer to the structure containing pointers to the file operations in
- * session mode. This pointer is requested in order to properly release allocated
- * memory when the session is closed
- *
  * dirty: indicates that the session buffer has been modified, so as the session
  * gets closed the modifications have to be propagated to the original file
  *
+ * modified: indicates that the commit in progress started writing into the original
+ * file or changing its size; if a commit ending the session fails after that, the
+ * session is not committed again (see "session_commit")
+ *
  * link_to_list: list_head structure connecting the session object to the list of
  * all session objects
  *
- * pages: list of objects of type "buffer_page", each corresponding to a page of the
- * buffer used for I/O sessions
+ * extents: array of objects of type "buffer_extent", each corresponding to a run of
+ * contiguous pages of the buffer, sorted by their position within the buffer; the
+ * pages of the buffer are tracked one run at a time, and data is copied to and from
+ * the buffer one run at a time
+ *
+ * nr_extents: number of runs of pages in the array "extents"
+ *
+ * max_extents: number of runs the array "extents" can hold before it has to be
+ * enlarged
  *
  * nr_pages: number of pages in the session buffer
  *
+ * nr_evicted: number of pages of the buffer released by the shrinker, which will
+ * be read again from the original file when accessed
+ *
+ * nr_compressed: number of pages of the buffer whose content is kept compressed,
+ * because they were not accessed for "session_compress_secs" seconds
+ *
+ * nr_holes: number of pages of the buffer belonging to holes, i.e. pages full
+ * of zeros which are not allocated (see "struct buffer_extent")
+ *
+ * snapshot_size: size of the original file when the session was opened, if the
+ * buffer starts with its content (0 otherwise); pages holding this content can be
+ * released under memory pressure as long as the file is not modified
+ *
+ * clean_size: number of bytes from the beginning of the buffer whose pages, while
+ * clean, hold the original content of the file; it's "snapshot_size" unless the
+ * session was shrunk below it (see "session_truncate")
+ *
+ * snapshot_mtime, snapshot_version: modification time and version of the original
+ * file when the session was opened, used to check that it was not modified
+ *
+ * hashes: array of the hashes of the pages holding the original content of the
+ * file, computed when they are filled (see "session_skip_unchanged"); NULL if the
+ * pages are not hashed
+ *
+ * nr_hashes: number of hashes in the array "hashes"
+ *
+ * inline_hash: hash of the original content of a small session kept inline
+ *
+ * in_place: indicates that the commit may write only the pages which changed; it's
+ * cleared when some of the original content is punched or truncated, since the
+ * file would still hold it
+ *
+ * shadow: shadow file the pages of the session are written into before the session
+ * is committed (see "session_shadow_secs"); NULL if there's none
+ *
+ * inline_data: slab object storing the content of a small session in place of
+ * the pages of the buffer (see "session_inline_max"); NULL if the session uses
+ * pages
+ *
+ * inline_size: number of bytes the object "inline_data" can hold
+ *
+ * node: NUMA node of the CPU which opened the session, where the pages of the
+ * buffer are allocated
+ *
+ * next_node: NUMA node of the next block of pages when the buffer is interleaved
+ * over the online nodes (see "session_interleave_mb")
+ *
  * filename: string representing the filename in the user-space
  *
  * file: pointer to the "struct file" associated to the opened file
@@ -65,38 +172,83 @@ struct session{
         struct mutex mutex;
         loff_t position;
         loff_t filesize;
+        loff_t base;
+        bool append;
         //int limit;
-        struct file_operations *f_ops_old;
-        struct file_operations *f_ops_new;
+        const struct file_operations *f_ops_old;
         bool dirty;
+        bool modified;
         struct list_head link_to_list;
-        struct list_head pages;
-        int nr_pages;
+        struct buffer_extent *extents;
+        unsigned long nr_extents;
+        unsigned long max_extents;
+        unsigned long nr_pages;
+        unsigned long nr_evicted;
+        unsigned long nr_compressed;
+        unsigned long nr_holes;
+        loff_t snapshot_size;
+        loff_t clean_size;
+        struct timespec snapshot_mtime;
+        u64 snapshot_version;
+        u64 *hashes;
+        unsigned long nr_hashes;
+        u64 inline_hash;
+        bool in_place;
+        struct file *shadow;
+        char *inline_data;
+        size_t inline_size;
+        int node;
+        int next_node;
         const char *filename;
         struct file *file;
         void* private;
 };
 
 /*
- * Structure to keep track of all the pages the session buffer is made of
+ * Structure to keep track of a run of pages of the session buffer which are
+ * contiguous both in the buffer and in the virtual address space, i.e. a block
+ * of pages obtained from a single allocation
+ *
+ * first_page: pointer to the descriptor of the first page of the run; the
+ * descriptors of the other pages follow it. NULL if the pages of the run were
+ * released by the shrinker, because they held the unmodified content of the file,
+ * if the content of the run was compressed or if the run is a hole
  *
- * head: link to to the head of the list of "buffer_pages", stored in the
- * session object
+ * address: virtual address of the first page of the run, NULL if the pages were
+ * released
  *
- * buffer_page_descriptor: pointer to the descriptor of the frame associated to this
- * element
+ * index: position of the first page of the run within the buffer
  *
- * buffer_page_address: virtual address into which the frame is mapped as
- * it is allocated for the session
+ * nr_pages: number of pages in the run
  *
- * index: position of the page within the buffer
+ * last_access: time (in jiffies) of the last copy to or from the run
+ *
+ * compressed: content of the run compressed with LZO when its pages were released
+ * because the run was not accessed for a while, NULL if the run is not compressed
+ *
+ * compressed_len: number of bytes in "compressed"
+ *
+ * compressed_dirty: indicates that some pages of the compressed run had been
+ * written, so they have to be marked as dirty again when the run is decompressed
+ *
+ * hole: indicates that the run is a hole of the session: its pages are full of
+ * zeros, so they are not allocated at all until they are written
+ *
+ * shadowed: number of pages, from the first one of the run, whose content is in
+ * the shadow file of the session (see "session_shadow_secs")
  */
 
-struct buffer_page{
-        struct list_head buffer_pages_head;
-        struct page* buffer_page_descriptor;
-        void* buffer_page_address;
-        int index;
+struct buffer_extent{
+        struct page* first_page;
+        void* address;
+        pgoff_t index;
+        unsigned long nr_pages;
+        unsigned long last_access;
+        void* compressed;
+        unsigned int compressed_len;
+        bool compressed_dirty;
+        bool hole;
+        unsigned long shadowed;
 };
 
 /*
@@ -104,10 +256,14 @@ struct buffer_page{
  *
  * head: head of a doubly linked list where each element is a session object
  * representing an active I/O session
+ *
+ * lock: spinlock protecting the list, which is scanned by the statistics of the
+ * session semantics while sessions are opened and closed
  */
 
 struct sessions_list{
         struct list_head sessions_head;
+        spinlock_t lock;
 };
 
 /*
@@ -116,9 +272,24 @@ struct sessions_list{
 
 extern asmlinkage long (*previous_open)(const char __user* filename,int flags,int mode);
 extern asmlinkage long sys_session_open(const char __user* filename,int flags,int mode);
-extern asmlinkage long (*truncate_call)(const char * path, long length);
+extern asmlinkage long (*previous_ftruncate)(unsigned int fd, unsigned long length);
+extern asmlinkage long sys_session_ftruncate(unsigned int fd, unsigned long length);
+extern asmlinkage long (*previous_fallocate)(int fd, int mode, loff_t offset, loff_t len);
+extern asmlinkage long sys_session_fallocate(int fd, int mode, loff_t offset, loff_t len);
 void sessions_remove(void);
 void sessions_list_init(struct sessions_list* sessions_list);
+int session_stats_init(void);
+void session_stats_remove(void);
+void session_memcg_init(void);
+void session_pool_init(void);
+void session_pool_remove(void);
+void session_reclaim_init(void);
+void session_reclaim_remove(void);
+void session_compress_init(void);
+void session_compress_remove(void);
+void session_shadow_init(void);
+void session_shadow_remove(void);
+bool session_snapshot_valid(struct session *session);
 
 /*
  * FUNCTION PROTOTYPES - end